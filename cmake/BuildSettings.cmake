@@ -11,6 +11,7 @@ set(DEPENDENCY_FOLDER "external")
 set_property(GLOBAL PROPERTY USE_FOLDERS ON)
 set_property(GLOBAL PROPERTY PREDEFINED_TARGETS_FOLDER ${DEPENDENCY_FOLDER})
 option(CHIPLET_FLAT_OUTPUT "Combine outputs (binaries, libs and archives) in top level bin and lib directories." ON)
+option(CHIPLET_WITH_TRACE "Support recording timing spans with --trace, without it the spans compile to nothing." ON)
 if(CHIPLET_FLAT_OUTPUT)
     link_directories(${CMAKE_BINARY_DIR}/lib)
     set(BINARY_OUT_DIR ${CMAKE_BINARY_DIR}/bin)
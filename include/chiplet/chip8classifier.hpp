@@ -0,0 +1,159 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/chip8classifier.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/chip8meta.hpp>
+#include <chiplet/mappedfile.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace emu {
+
+// A cheap first pass to tell if arbitrary data could be a CHIP-8 family program,
+// so only likely candidates need a full decompile. It rejects text, then follows
+// the control flow from the entry point for a bounded number of instructions and
+// checks how many of them are valid for any supported variant and how many jump
+// and call targets land inside of the program.
+class Chip8Classifier
+{
+public:
+    static constexpr size_t TEXT_WINDOW = 4096;
+    static constexpr int MAX_STEPS = 2048;
+    struct Result
+    {
+        bool candidate{false};
+        bool text{false};
+        int validOpcodes{0};
+        int invalidOpcodes{0};
+        int branches{0};
+        int plausibleBranches{0};
+    };
+
+    static Result classify(ByteView data, uint16_t startAddress = 0x200)
+    {
+        Result result;
+        if(data.size() < 4 || data.size() > size_t(0x1000000) - startAddress)
+            return result;
+        result.text = looksLikeText(data);
+        if(result.text)
+            return result;
+        traceCode(data, startAddress, result);
+        // longer traces may hit some data, short ones have to be clean and hit a valid branch
+        result.candidate = (result.validOpcodes >= 24 && result.invalidOpcodes * 16 <= result.validOpcodes && result.plausibleBranches * 4 >= result.branches * 3) ||
+                           (result.validOpcodes >= 11 && !result.invalidOpcodes && result.branches && result.plausibleBranches == result.branches);
+        return result;
+    }
+
+private:
+    static const detail::OpcodeSet& opcodeSet()
+    {
+        static const detail::OpcodeSet set(C8V::CHIP_8 | C8V::CHIP_8X | C8V::CHIP_8X_TPD | C8V::HI_RES_CHIP_8X | C8V::CHIP_10 | C8V::CHIP_48 | C8V::SCHIP_1_0 | C8V::SCHIP_1_1 | C8V::MEGA_CHIP | C8V::XO_CHIP);
+        return set;
+    }
+    static bool looksLikeText(ByteView data)
+    {
+        auto size = std::min(data.size(), TEXT_WINDOW);
+        size_t printable = 0;
+        for(size_t i = 0; i < size; ++i) {
+            auto c = data[i];
+            if((c >= 0x20 && c < 0x7f) || c == '\t' || c == '\n' || c == '\r')
+                ++printable;
+        }
+        return printable * 20 >= size * 19;
+    }
+    static void traceCode(ByteView data, uint16_t startAddress, Result& result)
+    {
+        const auto& set = opcodeSet();
+        const uint32_t end = startAddress + uint32_t(data.size());
+        auto inRange = [&](uint32_t address) { return address >= startAddress && address + 2 <= end; };
+        std::vector<bool> visited(data.size());
+        std::vector<uint32_t> worklist{startAddress};
+        int steps = 0;
+        while(!worklist.empty() && steps < MAX_STEPS) {
+            auto pc = worklist.back();
+            worklist.pop_back();
+            while(steps < MAX_STEPS) {
+                if(!inRange(pc)) {
+                    ++result.invalidOpcodes;
+                    break;
+                }
+                if(visited[pc - startAddress])
+                    break;
+                visited[pc - startAddress] = true;
+                ++steps;
+                uint16_t opcode = (data[pc - startAddress] << 8) | data[pc - startAddress + 1];
+                const auto* info = set.getOpcodeInfo(opcode);
+                // calls of native code are valid, but zero filled or random data is full of them
+                if(!info || (info->type == OT_Fnnn && (opcode & 0xF000) == 0)) {
+                    ++result.invalidOpcodes;
+                    break;
+                }
+                ++result.validOpcodes;
+                uint32_t target = opcode & 0xFFF;
+                auto next = pc + uint32_t(info->size);
+                if((opcode & 0xF000) == 0x1000) {
+                    ++result.branches;
+                    if(!inRange(target))
+                        break;
+                    ++result.plausibleBranches;
+                    pc = target;
+                    continue;
+                }
+                if((opcode & 0xF000) == 0x2000) {
+                    ++result.branches;
+                    if(inRange(target)) {
+                        ++result.plausibleBranches;
+                        worklist.push_back(target);
+                    }
+                }
+                else if(opcode == 0x00EE || opcode == 0x00FD || (opcode & 0xF000) == 0xB000) {
+                    break;
+                }
+                else if(isSkip(opcode)) {
+                    worklist.push_back(next + 2);
+                }
+                pc = next;
+            }
+        }
+    }
+    static bool isSkip(uint16_t opcode)
+    {
+        switch(opcode & 0xF000) {
+            case 0x3000:
+            case 0x4000:
+            case 0x5000:
+            case 0x9000:
+                return true;
+            case 0xE000:
+                return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+            default:
+                return false;
+        }
+    }
+};
+
+}
@@ -29,11 +29,17 @@
 #pragma once
 
 #include <chiplet/chip8meta.hpp>
+#include <chiplet/opcodematcher.hpp>
+#include <chiplet/sequencematcher.hpp>
+#include <chiplet/trace.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <map>
+#include <queue>
 #include <unordered_map>
 #include <tuple>
 #include <vector>
@@ -63,6 +69,108 @@ public:
         UsageType type{};
         int index{-1};
     };
+    // Labels by address: addresses below the dense limit (at most 64k) are kept in a presence
+    // bitmap and a LabelInfo array indexed by address, so refLabel and labelOrAddress don't
+    // walk or allocate tree nodes, the 24-bit MegaChip addresses above go to a sparse map.
+    // Iteration is in address order and, like with std::map, labels added during an iteration
+    // are visited if they come after the current one.
+    class LabelTable
+    {
+    public:
+        static constexpr uint32_t MAX_DENSE = 0x10000;
+        static constexpr uint64_t NONE = uint64_t(1) << 32; // past any 32-bit address, 0xFFFFFFFF is a valid one
+        class iterator
+        {
+        public:
+            iterator(LabelTable* table, uint64_t addr) : _table(table), _addr(addr) {}
+            std::pair<uint32_t, LabelInfo&> operator*() const { return {uint32_t(_addr), *_table->find(uint32_t(_addr))}; }
+            iterator& operator++()
+            {
+                _addr = _table->next(_addr + 1);
+                return *this;
+            }
+            bool operator!=(const iterator& other) const { return _addr != other._addr; }
+        private:
+            LabelTable* _table;
+            uint64_t _addr;
+        };
+        explicit LabelTable(uint32_t denseLimit = 0x1000) { reserve(denseLimit); }
+        // grows the dense part to cover addresses below denseLimit (rounded up, at most 64k)
+        void reserve(uint32_t denseLimit)
+        {
+            denseLimit = std::min(MAX_DENSE, (denseLimit + 63) & ~63u);
+            if(denseLimit <= _denseLimit)
+                return;
+            _denseLimit = denseLimit;
+            _present.resize(_denseLimit / 64);
+            _dense.resize(_denseLimit);
+            for(auto iter = _sparse.begin(); iter != _sparse.end() && iter->first < _denseLimit;) {
+                _present[iter->first >> 6] |= uint64_t(1) << (iter->first & 63);
+                _dense[iter->first] = iter->second;
+                iter = _sparse.erase(iter);
+            }
+        }
+        LabelInfo* find(uint32_t addr)
+        {
+            if(addr < _denseLimit)
+                return (_present[addr >> 6] >> (addr & 63)) & 1 ? &_dense[addr] : nullptr;
+            auto iter = _sparse.find(addr);
+            return iter != _sparse.end() ? &iter->second : nullptr;
+        }
+        const LabelInfo* find(uint32_t addr) const { return const_cast<LabelTable*>(this)->find(addr); }
+        bool contains(uint32_t addr) const { return find(addr) != nullptr; }
+        // returns the label at addr, adding an empty one if there was none
+        LabelInfo& operator[](uint32_t addr)
+        {
+            if(addr < _denseLimit) {
+                auto& word = _present[addr >> 6];
+                auto bit = uint64_t(1) << (addr & 63);
+                if(!(word & bit)) {
+                    word |= bit;
+                    _dense[addr] = {};
+                }
+                return _dense[addr];
+            }
+            return _sparse[addr];
+        }
+        iterator begin() { return {this, next(0)}; }
+        iterator end() { return {this, NONE}; }
+    private:
+        // the lowest address with a label at or above addr, NONE if there is none
+        uint64_t next(uint64_t addr) const
+        {
+            if(addr < _denseLimit) {
+                auto index = addr >> 6;
+                auto word = _present[index] & (~uint64_t(0) << (addr & 63));
+                while(!word && ++index < _present.size())
+                    word = _present[index];
+                if(word)
+                    return (uint64_t(index) << 6) + lowestBit(word);
+                addr = _denseLimit;
+            }
+            if(addr >= NONE)
+                return NONE;
+            auto iter = _sparse.lower_bound(uint32_t(addr));
+            return iter != _sparse.end() ? iter->first : NONE;
+        }
+        static uint32_t lowestBit(uint64_t word)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return uint32_t(__builtin_ctzll(word));
+#else
+            uint32_t bit = 0;
+            while(!(word & 1)) {
+                word >>= 1;
+                ++bit;
+            }
+            return bit;
+#endif
+        }
+        uint32_t _denseLimit{0};
+        std::vector<uint64_t> _present;
+        std::vector<LabelInfo> _dense;
+        std::map<uint32_t, LabelInfo> _sparse;
+    };
     struct EmulationContext {
         explicit EmulationContext(const uint16_t addr) : rPC(addr) {}
         int rV[16]{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1};
@@ -77,18 +185,6 @@ public:
     : _possibleVariants(variants)
     , _opcodeSet(variants, [this](uint32_t addr){ return labelOrAddress(addr); })
     {
-        if(_mappedOpcodeInfo.empty()) {
-            _mappedOpcodeInfo.resize(65536);
-            for(uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
-                for(const auto& info : detail::opcodes) {
-                    if((opcode & detail::opcodeMasks[info.type]) == info.opcode) {
-                        _mappedOpcodeInfo[opcode].push_back(&info);
-                    }
-                }
-                if(_mappedOpcodeInfo[opcode].empty())
-                    _mappedOpcodeInfo[opcode].push_back(nullptr);
-            }
-        }
         //possibleVariants = static_cast<Chip8Variant>(~uint64_t{0});
     }
 
@@ -96,7 +192,7 @@ public:
     {
         if(force || _possibleVariants != variant) {
             _possibleVariants = variant;
-            _opcodeSet = detail::OpcodeSet(_possibleVariants, [this](uint32_t addr){ return labelOrAddress(addr); });
+            _opcodeSet.setVariant(_possibleVariants);
             _opcodeSet.formatInvalidAsHex(formatInvalidAsHex);
         }
     }
@@ -110,23 +206,21 @@ public:
 
     void refLabel(uint32_t addr, UsageType type)
     {
-        auto i = _label.find(addr);
-        if(i == _label.end()) {
-            _label[addr] = {type, -1};
-        }
-        else {
-            _label[addr].type = static_cast<UsageType>(_label[addr].type | type);
-        }
+        auto& info = _label[addr];
+        info.type = static_cast<UsageType>(info.type | type);
+        if(_discovering && (type & (eJUMP | eCALL)))
+            (int64_t(addr) > _discoveryPosition ? _pendingTargets : _nextSweepTargets).push(addr);
     }
 
+    // The chunks tile the loaded image without gaps or overlaps and splitChunk only ever
+    // subdivides them, so the chunk containing addr is the last one starting at or below it.
     Chunk* findChunk(uint32_t addr)
     {
-        for(auto& [offset, chunk] : _chunks) {
-            if(offset <= addr && chunk.end - chunk.start + offset > addr) {
-                return &chunk;
-            }
-        }
-        return nullptr;
+        auto iter = _chunks.upper_bound(addr);
+        if(iter == _chunks.begin())
+            return nullptr;
+        --iter;
+        return addr < iter->second.endAddr() ? &iter->second : nullptr;
     }
 
     void splitChunk(Chunk*& chunk, const uint8_t* start, uint32_t size, UsageType type)
@@ -143,7 +237,7 @@ public:
         }
         if(chunk->end > start + size) {
             // seperate suffix chunk
-            Chunk suffix = {uint16_t(chunk->offset + (start - chunk->start) + size), start + size, chunk->end, chunk->usageType};
+            Chunk suffix = {uint32_t(chunk->offset + (start - chunk->start) + size), start + size, chunk->end, chunk->usageType};
             _chunks[suffix.offset] = suffix;
             chunk->end = start + size;
         }
@@ -152,19 +246,18 @@ public:
 
     std::string labelOrAddress(uint32_t addr, bool orNumber = false) const
     {
-        auto i = _label.find(addr);
-        if(i != _label.end()) {
-            uint32_t number = i->second.index >= 0 ? i->second.index : addr;
-            if(i->second.type & eJUMP) {
+        if(const auto* info = _label.find(addr)) {
+            uint32_t number = info->index >= 0 ? info->index : addr;
+            if(info->type & eJUMP) {
                 return fmt::format("label_{}", number);
             }
-            else if(i->second.type & eCALL) {
+            else if(info->type & eCALL) {
                 return fmt::format("sub_{}", number);
             }
-            else if(i->second.type & eSPRITE) {
+            else if(info->type & eSPRITE) {
                 return fmt::format("sprite_{}", number);
             }
-            else if(i->second.type & eAUDIO) {
+            else if(info->type & eAUDIO) {
                 return fmt::format("audio_{}", number);
             }
             return fmt::format("data_{}", number);
@@ -298,18 +391,15 @@ public:
         if(chunk.usageType & (eJUMP | eCALL)) {
             while (code + 1 < chunk.end) {
                 auto [size, opcode, instruction] = opcode2Str(code, chunk.end);
-                auto labelIter = _label.find(addr);
-                if (labelIter != _label.end()) {
+                if (_label.contains(addr)) {
                     os << fmt::format(": {}", labelOrAddress(addr)) << std::endl;
                 }
-                labelIter = _label.find(addr+1);
-                if (labelIter != _label.end()) {
+                if (_label.contains(addr + 1)) {
                     os << fmt::format(":next {}", labelOrAddress(addr+1)) << std::endl;
                 }
                 if(size == 4) {
-                    labelIter = _label.find(addr + 2);
                     auto next = readOpcode(code + 2);
-                    if(labelIter != _label.end()) {
+                    if(_label.contains(addr + 2)) {
                         instruction = fmt::format("i_long_labeled {} {}", labelOrAddress(addr + 2), labelOrAddress(next, true));
                     }
                 }
@@ -325,16 +415,16 @@ public:
         }
         bool inSpriteMode = false;
         for(int i = 0; code < chunk.end; ++i, ++addr, ++code) {
-            auto labelIter = _label.find(addr);
-            if (labelIter != _label.end()) {
+            const auto* label = _label.find(addr);
+            if (label) {
                 os << fmt::format("\n: {}\n", labelOrAddress(addr));
-                inSpriteMode = (labelIter->second.type & eSPRITE) && _possibleVariants != C8V::MEGA_CHIP;
+                inSpriteMode = (label->type & eSPRITE) && _possibleVariants != C8V::MEGA_CHIP;
             }
             if(inSpriteMode) {
                 os << "        " << fmt::format("0b{:08b}\n", *code);
             }
             else {
-                if (!(i % 8) || labelIter != _label.end())
+                if (!(i % 8) || label)
                     os << (i > 0 ? "\n" : "") << "       ";
                 os << fmt::format(" 0x{:02X}", *code);
             }
@@ -640,15 +730,9 @@ public:
             if(ec.rPC & 1)
                 _oddPcAccess = true;
             auto opcode = readOpcode(code);
-            Chip8Variant mask = (Chip8Variant)0;
-            for(auto info : _mappedOpcodeInfo[opcode])
-                if(info && info->opcode) {
-                    if(info->variants != Chip8Variant::MEGA_CHIP || opcode == 0x0011)
-                        mask |= info->variants;
-                }
-            //const OpcodeInfo* info = mappedOpcodeInfo[opcode].front();
-            if((uint64_t)mask) {
-                _possibleVariants &= mask;
+            auto mask = opcodeVariants().variantMask[opcode];
+            if(mask) {
+                _possibleVariants &= static_cast<Chip8Variant>(mask);
                 //if (!(uint64_t)_possibleVariants)
                 //    std::cerr << "huuuu" << std::endl;
             }
@@ -699,7 +783,7 @@ public:
         int dataLabel = 0;
         int spriteLabel = 0;
         int audioLabel = 0;
-        for(auto& [addr, info] : _label) {
+        for(auto [addr, info] : _label) {
             if(info.type & eJUMP) {
                 info.index = jumpLabel++;
             }
@@ -734,12 +818,6 @@ public:
                 }
                 else
                     ++iter->second;
-                auto iter2 = _totalStats.find(opcode);
-                if(iter2 == _totalStats.end()) {
-                    _totalStats.emplace(opcode, 1);
-                }
-                else
-                    ++iter2->second;
                 iter = _fullStats.find(rawOpcode);
                 if(iter == _fullStats.end()) {
                     _fullStats.emplace(rawOpcode, 1);
@@ -757,31 +835,45 @@ public:
         auto start = std::chrono::steady_clock::now();
         _start = code;
         _size = size;
-        _chunks[offset] = {offset, code, code + size, eNONE};
-        auto chunkSize = analyseCodeChunk(_chunks[offset], entry);
-        Chunk* chunk = &_chunks[offset];
-        splitChunk(chunk, code, chunkSize, eJUMP);
-        dumpChunks();
-
-        bool iterate;
-        do {
-            iterate = false;
-            for (auto& [labelOffset, info] : _label) {
-                if(info.type & (eJUMP | eCALL)) {
-                    chunk = findChunk(labelOffset);
-                    if (chunk && chunk->usageType == eNONE) {
-                        chunkSize = analyseCodeChunk(*chunk, labelOffset);
-                        splitChunk(chunk, chunk->start + (labelOffset - chunk->offset), chunkSize, info.type);
-                        dumpChunks();
-                        iterate = true;
-                    }
+        _label.reserve(uint32_t(offset) + size);
+        {
+            CHIPLET_TRACE_SPAN("decompile: code discovery");
+            _discovering = true;
+            _discoveryPosition = -1;
+            _chunks[offset] = {offset, code, code + size, eNONE};
+            auto chunkSize = analyseCodeChunk(_chunks[offset], entry);
+            Chunk* chunk = &_chunks[offset];
+            splitChunk(chunk, code, chunkSize, eJUMP);
+            dumpChunks();
+
+            // Every jump or call target is looked at once, in the order repeated ascending sweeps
+            // over all labels would find it, so the chunks come out exactly the same: targets
+            // after the current position are taken in this sweep, the others in the next one.
+            // A target already inside analysed code stays there, so it can be dropped for good.
+            while(!_pendingTargets.empty() || !_nextSweepTargets.empty()) {
+                if(_pendingTargets.empty()) {
+                    std::swap(_pendingTargets, _nextSweepTargets);
+                    _discoveryPosition = -1;
+                }
+                auto labelOffset = _pendingTargets.top();
+                _pendingTargets.pop();
+                if(int64_t(labelOffset) == _discoveryPosition)
+                    continue;
+                _discoveryPosition = labelOffset;
+                chunk = findChunk(labelOffset);
+                if (chunk && chunk->usageType == eNONE) {
+                    chunkSize = analyseCodeChunk(*chunk, labelOffset);
+                    splitChunk(chunk, chunk->start + (labelOffset - chunk->offset), chunkSize, _label.find(labelOffset)->type);
+                    dumpChunks();
                 }
             }
-        } while(iterate);
+            _discovering = false;
+        }
 
         if(!_megaChipEnabled)
             _possibleVariants &= ~C8V::MEGA_CHIP;
         if(analyzeOnly) {
+            CHIPLET_TRACE_SPAN("decompile: opcode statistics");
             for (auto& [chunkOffset, chunk] : _chunks) {
                 // std::cout << fmt::format(":org {:04X} # size: {:04X}", chunkOffset, uint32_t(chunk.end - chunk.start)) << std::endl;
                 generateInfoFromChunk(chunk);
@@ -791,6 +883,7 @@ public:
             }
         }
         else if(os) {
+            CHIPLET_TRACE_SPAN("decompile: source generation");
             renumerateLabels();
             *os << "# This is an automatically generated source, created by the Cadmium-Decompiler\n# ROM file used: " << filename << "\n\n";
             if(containedAny(_possibleVariants, C8V::CHIP_8X|C8V::CHIP_8X_TPD|C8V::HI_RES_CHIP_8X|C8V::MEGA_CHIP|C8V::XO_CHIP))
@@ -846,7 +939,7 @@ public:
             if(containedAny(_possibleVariants, C8V::CHIP_8X|C8V::CHIP_8X_TPD|C8V::HI_RES_CHIP_8X|C8V::MEGA_CHIP|C8V::XO_CHIP))
                 *os << "#--------------------------------------------------------------\n\n";
             bool hasConsts = false;
-            for(auto& [addr, info] : _label) {
+            for(auto [addr, info] : _label) {
                 if(!findChunk(addr)) {
                     *os << fmt::format(":const {} 0x{:04X}\n", labelOrAddress(addr), addr);
                     hasConsts = true;
@@ -865,44 +958,144 @@ public:
     }
 
     void listUsages(uint16_t forOpcode, uint16_t mask, std::ostream& os)
+    {
+        OpcodeMatcher matcher;
+        matcher.add(forOpcode, mask);
+        std::vector<std::string> usages(1);
+        listUsages(matcher, usages);
+        os << usages.front();
+    }
+
+    // Appends the usages of every pattern of the matcher to usages[patternIndex], all
+    // patterns are collected in a single pass over the code.
+    void listUsages(const OpcodeMatcher& matcher, std::vector<std::string>& usages)
     {
         static std::regex rxReg("v([0-9A-F])");
+        usages.resize(std::max(usages.size(), size_t(matcher.size())));
         for (auto& [chunkOffset, chunk] : _chunks) {
-            auto addr = chunk.offset;
-            auto* code = chunk.start;
             if(chunk.usageType & (eJUMP | eCALL)) {
                 analyseCodeChunk(chunk, chunk.offset, [&](const EmulationContext& ec, uint16_t opcode, int next){
-                    if((opcode & mask) == forOpcode) {
-                        auto [size, op, instruction] = _opcodeSet.formatOpcode(opcode, next);
-                        os << "    " << instruction;
-                        bool first = true;
-                        for(auto i = std::sregex_iterator(instruction.begin(), instruction.end(), rxReg);
-                             i != std::sregex_iterator();
-                             ++i ) {
-                            auto regVal = ec.rV[std::stoi((*i)[1].str(), nullptr, 16)];
-                            if(regVal >= 0) {
-                                if (first)
-                                    os << "    #";
-                                os << " " << i->str() << "=" << regVal;
-                                first = false;
-                            }
+                    if(!matcher.matches(opcode))
+                        return;
+                    auto [size, op, instruction] = _opcodeSet.formatOpcode(opcode, next);
+                    std::string line = "    " + instruction;
+                    bool first = true;
+                    for(auto i = std::sregex_iterator(instruction.begin(), instruction.end(), rxReg);
+                         i != std::sregex_iterator();
+                         ++i ) {
+                        auto regVal = ec.rV[std::stoi((*i)[1].str(), nullptr, 16)];
+                        if(regVal >= 0) {
+                            if (first)
+                                line += "    #";
+                            line += " " + i->str() + "=" + std::to_string(regVal);
+                            first = false;
+                        }
+                    }
+                    line += "\n";
+                    for(auto index : matcher.patterns(opcode)) {
+                        usages[index] += line;
+                    }
+                });
+            }
+        }
+    }
+
+    // Runs the sequence matcher over the opcodes of every code chunk, the callback gets the
+    // address and the opcodes of each match and the index of the matched sequence.
+    void findSequences(const SequenceMatcher& matcher, const std::function<void(uint32_t address, uint32_t sequence, const std::vector<uint16_t>& opcodes)>& found)
+    {
+        auto window = std::max(matcher.maxLength(), size_t(1));
+        std::vector<uint32_t> addresses(window);
+        std::vector<uint16_t> opcodes(window), match;
+        for (auto& [chunkOffset, chunk] : _chunks) {
+            if(chunk.usageType & (eJUMP | eCALL)) {
+                auto state = matcher.start();
+                size_t pos = 0;
+                // the emulated PC is 16 bit, chunks of MegaChip images can be above 64k
+                uint32_t address = chunk.offset;
+                analyseCodeChunk(chunk, chunk.offset, [&](const EmulationContext&, uint16_t opcode, int next){
+                    addresses[pos % window] = address;
+                    address += next >= 0 ? 4 : 2;
+                    opcodes[pos % window] = opcode;
+                    ++pos;
+                    state = matcher.next(state, opcode);
+                    for(auto sequence : matcher.matches(state)) {
+                        auto length = matcher.sequence(sequence).size();
+                        match.clear();
+                        for(auto i = pos - length; i < pos; ++i) {
+                            match.push_back(opcodes[i % window]);
                         }
-                        os << "\n";
+                        found(addresses[(pos - length) % window], sequence, match);
                     }
                 });
             }
         }
     }
 
+    // Calls back with the address and the (opcode, long operand or -1) pairs of every code
+    // chunk with one of the given usage types, e.g. eCALL for all called subroutines, up to
+    // its first return or unconditional jump.
+    void forEachCodeChunk(int usageTypes, const std::function<void(uint32_t address, const std::vector<std::pair<uint16_t, int>>& code)>& callback)
+    {
+        std::vector<std::pair<uint16_t, int>> code;
+        for (auto& [chunkOffset, chunk] : _chunks) {
+            if(chunk.usageType & usageTypes) {
+                code.clear();
+                analyseCodeChunk(chunk, chunk.offset, [&](const EmulationContext&, uint16_t opcode, int next){
+                    code.emplace_back(opcode, next);
+                });
+                callback(chunk.offset, code);
+            }
+        }
+    }
+
+    // Number of bytes in chunks reached as code, everything else of the program is data.
+    uint32_t codeSize() const
+    {
+        uint32_t size = 0;
+        for (const auto& [chunkOffset, chunk] : _chunks) {
+            if(chunk.usageType & (eJUMP | eCALL))
+                size += chunk.size();
+        }
+        return size;
+    }
+
     bool usesOddPcAddress() const { return _oddPcAccess; }
     Chip8Variant possibleVariants() const { return _possibleVariants; }
+    const auto& stats() const { return _stats; }
     const auto& fullStats() const { return _fullStats; }
-    static const auto& totalStats() { return _totalStats; }
 
     static std::pair<int, std::string> disassemble1802InstructionWithBytes(int32_t pc, const uint8_t* code, const uint8_t* end);
     static std::pair<int, std::string> disassemble1802Instruction(const uint8_t* code, const uint8_t* end);
 
 private:
+    // Per opcode the variants it is valid in (ignoring the 0x0000 entries and the MegaChip only
+    // ones besides megaon, as they don't tell anything about the variant), filled by walking
+    // the argument bits of every entry instead of testing each opcode against the whole table.
+    struct OpcodeVariantTable
+    {
+        OpcodeVariantTable()
+        {
+            for(const auto& info : detail::opcodes) {
+                uint16_t argMask = ~detail::opcodeMasks[info.type];
+                uint16_t val = 0;
+                do {
+                    uint16_t opcode = info.opcode | (val & argMask);
+                    if(info.opcode && (info.variants != Chip8Variant::MEGA_CHIP || opcode == 0x0011))
+                        variantMask[opcode] |= uint64_t(info.variants);
+                    val = (val | ~argMask) + 1;
+                } while(val & argMask);
+            }
+        }
+        uint64_t variantMask[0x10000]{};
+    };
+
+    static const OpcodeVariantTable& opcodeVariants()
+    {
+        // initialized on first use, thread-safe as a function local static
+        static const OpcodeVariantTable table;
+        return table;
+    }
 
     std::string _filename;
     const uint8_t* _start{};
@@ -912,11 +1105,14 @@ private:
     Chip8Variant _possibleVariants{};
     detail::OpcodeSet _opcodeSet;
     std::map<uint32_t, Chunk> _chunks;
-    std::map<uint32_t, LabelInfo> _label;
+    LabelTable _label;
+    using TargetQueue = std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>>;
+    TargetQueue _pendingTargets;
+    TargetQueue _nextSweepTargets;
+    int64_t _discoveryPosition{-1};
+    bool _discovering{false};
     std::unordered_map<uint16_t, int> _stats;
     std::unordered_map<uint16_t, int> _fullStats;
-    inline static std::map<uint16_t, int> _totalStats;
-    inline static std::vector<std::vector<const OpcodeInfo*>> _mappedOpcodeInfo;
 };
 
 }
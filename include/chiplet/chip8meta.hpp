@@ -29,9 +29,12 @@
 #include <fmt/format.h>
 
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -175,28 +178,109 @@ inline static std::map<std::string, std::string> octoMacros = {
     {"input3", ":macro input3 reg { :calc FX { 0xF0 + ( reg & 0xF ) } :byte FX :byte 0xe7 }"}
 };
 
-class OpcodeSet
+// Immutable opcode to OpcodeInfo map for a set of variants. Tables are shared process
+// wide through forVariant(), as the handful of variant masks seen in practice would
+// otherwise be rebuilt for every decompiled ROM.
+class OpcodeTable
 {
 public:
-    using SymbolResolver = std::function<std::string(uint32_t)>;
-    explicit OpcodeSet(Chip8Variant variant, SymbolResolver resolver = {})
+    explicit OpcodeTable(Chip8Variant variant)
     : _variant(variant)
-    , _labelOrAddress(std::move(resolver))
-    , _mappedInfo(0x10000, 0xff)
     {
+        _mappedInfo.fill(0xff);
         for(const auto& info : opcodes) {
             if(uint64_t(info.variants & variant) != 0) {
                 mapOpcode(opcodeMasks[info.type], info.opcode, &info - opcodes.data());
             }
         }
     }
-    void formatInvalidAsHex(bool asHex) { _invalidAsHex = asHex; }
+    OpcodeTable(const OpcodeTable&) = delete;
+    OpcodeTable& operator=(const OpcodeTable&) = delete;
+
+    // Tables are created on first request and live for the whole process (they are only
+    // destroyed at exit). Finding an existing one is lock-free: the first PUBLISHED_SLOTS
+    // tables are also published in an open addressed array of atomic pointers that is only
+    // written under the mutex, so just creating a table (or looking up one of the rare
+    // ones beyond that) takes the lock.
+    static const OpcodeTable& forVariant(Chip8Variant variant)
+    {
+        static constexpr size_t PUBLISHED_SLOTS = 64;
+        static std::array<std::atomic<const OpcodeTable*>, PUBLISHED_SLOTS> published{};
+        static std::mutex mutex;
+        static std::map<uint64_t, std::unique_ptr<const OpcodeTable>> tables;
+        auto key = uint64_t(variant);
+        auto home = size_t((key * 0x9E3779B97F4A7C15ull) >> 58);
+        for(size_t i = 0; i < PUBLISHED_SLOTS; ++i) {
+            const auto* table = published[(home + i) % PUBLISHED_SLOTS].load(std::memory_order_acquire);
+            if(!table)
+                break;
+            if(uint64_t(table->_variant) == key)
+                return *table;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& table = tables[key];
+        if(!table) {
+            table = std::make_unique<const OpcodeTable>(variant);
+            for(size_t i = 0; i < PUBLISHED_SLOTS; ++i) {
+                auto& slot = published[(home + i) % PUBLISHED_SLOTS];
+                if(!slot.load(std::memory_order_relaxed)) {
+                    slot.store(table.get(), std::memory_order_release);
+                    break;
+                }
+            }
+        }
+        return *table;
+    }
     [[nodiscard]] Chip8Variant getVariant() const { return _variant; }
     [[nodiscard]] const OpcodeInfo* getOpcodeInfo(uint16_t opcode) const
     {
         auto index = _mappedInfo[opcode];
         return index == 0xff ? nullptr : &opcodes[index];
     }
+private:
+    void setIfEmpty(uint16_t index, uint8_t value)
+    {
+        if(_mappedInfo[index] == 0xff)
+            _mappedInfo[index] = value;
+    }
+    void mapOpcode(uint16_t mask, uint16_t opcode, uint8_t infoIndex)
+    {
+        uint16_t argMask = ~mask;
+        int shift = 0;
+        if(argMask) {
+            while((argMask & 1) == 0) {
+                argMask >>= 1;
+                ++shift;
+            }
+            uint16_t val = 0;
+            do {
+                setIfEmpty(opcode | ((val & argMask) << shift), infoIndex);
+            }
+            while(++val & argMask);
+        }
+        else {
+            setIfEmpty(opcode, infoIndex);
+        }
+    }
+    Chip8Variant _variant;
+    std::array<uint8_t, 0x10000> _mappedInfo{};
+};
+
+// Formats opcodes of a set of variants, a cheap handle to the shared OpcodeTable plus the
+// resolver used for address arguments.
+class OpcodeSet
+{
+public:
+    using SymbolResolver = std::function<std::string(uint32_t)>;
+    explicit OpcodeSet(Chip8Variant variant, SymbolResolver resolver = {})
+    : _table(&OpcodeTable::forVariant(variant))
+    , _labelOrAddress(std::move(resolver))
+    {
+    }
+    void setVariant(Chip8Variant variant) { _table = &OpcodeTable::forVariant(variant); }
+    void formatInvalidAsHex(bool asHex) { _invalidAsHex = asHex; }
+    [[nodiscard]] Chip8Variant getVariant() const { return _table->getVariant(); }
+    [[nodiscard]] const OpcodeInfo* getOpcodeInfo(uint16_t opcode) const { return _table->getOpcodeInfo(opcode); }
     [[nodiscard]] std::tuple<uint16_t, uint16_t, std::string> formatOpcode(uint16_t opcode, uint16_t nnnn = 0) const
     {
         static const char* hex = "0123456789abcdef";
@@ -270,33 +354,8 @@ public:
         return {info->size, info->opcode, result};
     }
 private:
-    void setIfEmpty(uint16_t index, uint8_t value)
-    {
-        if(_mappedInfo[index] == 0xff)
-            _mappedInfo[index] = value;
-    }
-    void mapOpcode(uint16_t mask, uint16_t opcode, uint8_t infoIndex)
-    {
-        uint16_t argMask = ~mask;
-        int shift = 0;
-        if(argMask) {
-            while((argMask & 1) == 0) {
-                argMask >>= 1;
-                ++shift;
-            }
-            uint16_t val = 0;
-            do {
-                setIfEmpty(opcode | ((val & argMask) << shift), infoIndex);
-            }
-            while(++val & argMask);
-        }
-        else {
-            setIfEmpty(opcode, infoIndex);
-        }
-    }
-    Chip8Variant _variant;
+    const OpcodeTable* _table;
     SymbolResolver _labelOrAddress;
-    std::vector<uint8_t> _mappedInfo{};
     bool _invalidAsHex = false;
 };
 
@@ -0,0 +1,107 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/latencyhistogram.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace ghc {
+
+// A fixed-size log-linear histogram for latency values (e.g. microseconds). Every power
+// of two range is split into 32 linear sub-buckets, so percentiles have a relative error
+// of about 3% no matter how many values were added, while memory use stays constant.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr uint64_t SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void add(uint64_t value)
+    {
+        ++_buckets[bucketIndex(value)];
+        ++_count;
+        _sum += value;
+        _max = std::max(_max, value);
+    }
+    void merge(const LatencyHistogram& other)
+    {
+        for(size_t i = 0; i < NUM_BUCKETS; ++i) {
+            _buckets[i] += other._buckets[i];
+        }
+        _count += other._count;
+        _sum += other._sum;
+        _max = std::max(_max, other._max);
+    }
+    uint64_t count() const { return _count; }
+    uint64_t sum() const { return _sum; }
+    uint64_t max() const { return _max; }
+    // Returns the upper bound of the bucket containing the value at the given percentile
+    // (0-100), clamped to the biggest value seen.
+    uint64_t percentile(double p) const
+    {
+        if(!_count)
+            return 0;
+        auto rank = std::max(uint64_t(1), uint64_t(std::ceil(p / 100.0 * double(_count))));
+        uint64_t seen = 0;
+        for(size_t i = 0; i < NUM_BUCKETS; ++i) {
+            seen += _buckets[i];
+            if(seen >= rank)
+                return std::min(bucketUpperBound(i), _max);
+        }
+        return _max;
+    }
+    const std::array<uint64_t, NUM_BUCKETS>& buckets() const { return _buckets; }
+
+    static size_t bucketIndex(uint64_t value)
+    {
+        if(value < 2 * SUB_BUCKETS)
+            return size_t(value);
+        int msb = 63;
+        while(!(value & (1ull << msb)))
+            --msb;
+        auto exponent = msb - SUB_BUCKET_BITS;
+        return size_t(exponent) * SUB_BUCKETS + size_t(value >> exponent);
+    }
+    static uint64_t bucketUpperBound(size_t index)
+    {
+        if(index < 2 * SUB_BUCKETS)
+            return index;
+        auto exponent = index / SUB_BUCKETS - 1;
+        auto mantissa = index - exponent * SUB_BUCKETS;
+        return ((mantissa + 1) << exponent) - 1;
+    }
+
+private:
+    std::array<uint64_t, NUM_BUCKETS> _buckets{};
+    uint64_t _count{0};
+    uint64_t _sum{0};
+    uint64_t _max{0};
+};
+
+}
@@ -0,0 +1,159 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/mappedfile.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <ghc/fs_fwd.hpp>
+#include <ghc/span.hpp>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = ghc::filesystem;
+
+namespace emu {
+
+using ByteView = ghc::span<const uint8_t>;
+
+// Read-only view on the content of a file. On POSIX systems bigger files are memory
+// mapped, small ones (where mmap/munmap and the page fault cost more than the copy) and
+// anything that can't be mapped are read with pread into an owned buffer. Like loadFile(),
+// files bigger than maxSize or unreadable files give an empty view.
+class MappedFile
+{
+public:
+    enum Mode { eAUTO, eREAD, eMAP };
+    static constexpr size_t MAP_THRESHOLD = 64 * 1024;
+    MappedFile() = default;
+    explicit MappedFile(const fs::path& file, size_t maxSize = 16 * 1024 * 1024, Mode mode = eAUTO)
+    {
+#if defined(_WIN32)
+        (void)mode;
+        std::ifstream is(file, std::ios::binary | std::ios::ate);
+        auto size = is.tellg();
+        if(size <= 0 || size_t(size) > maxSize)
+            return;
+        is.seekg(0, std::ios::beg);
+        _buffer.resize(size_t(size));
+        if(!is.read((char*)_buffer.data(), size)) {
+            _buffer.clear();
+            return;
+        }
+        _data = _buffer.data();
+        _size = _buffer.size();
+#else
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            return;
+        struct stat st{};
+        if(::fstat(fd, &st) == 0 && st.st_size > 0 && size_t(st.st_size) <= maxSize) {
+            auto size = size_t(st.st_size);
+            if(S_ISREG(st.st_mode) && (mode == eMAP || (mode == eAUTO && size >= MAP_THRESHOLD))) {
+                void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapping != MAP_FAILED) {
+                    _mapping = mapping;
+                    _data = static_cast<const uint8_t*>(mapping);
+                    _size = size;
+                }
+            }
+            if(!_mapping && !readAll(fd, size)) {
+                _buffer.clear();
+            }
+        }
+        ::close(fd);
+#endif
+    }
+    ~MappedFile() { release(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if(this != &other) {
+            release();
+            _mapping = std::exchange(other._mapping, nullptr);
+            _buffer = std::move(other._buffer);
+            _data = _mapping ? static_cast<const uint8_t*>(_mapping) : _buffer.data();
+            _size = std::exchange(other._size, 0);
+            other._data = nullptr;
+        }
+        return *this;
+    }
+
+    bool empty() const { return _size == 0; }
+    bool isMapped() const { return _mapping != nullptr; }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    const uint8_t* begin() const { return _data; }
+    const uint8_t* end() const { return _data + _size; }
+    ByteView view() const { return {_data, _size}; }
+    operator ByteView() const { return view(); }
+
+private:
+#if !defined(_WIN32)
+    bool readAll(int fd, size_t size)
+    {
+        _buffer.resize(size);
+        size_t offset = 0;
+        while(offset < size) {
+            auto rc = ::pread(fd, _buffer.data() + offset, size - offset, off_t(offset));
+            if(rc <= 0)
+                return false;
+            offset += size_t(rc);
+        }
+        _data = _buffer.data();
+        _size = size;
+        return true;
+    }
+#endif
+    void release()
+    {
+#if !defined(_WIN32)
+        if(_mapping)
+            ::munmap(_mapping, _size);
+#endif
+        _mapping = nullptr;
+        _data = nullptr;
+        _size = 0;
+        _buffer.clear();
+    }
+    void* _mapping{nullptr};
+    const uint8_t* _data{nullptr};
+    size_t _size{0};
+    std::vector<uint8_t> _buffer;
+};
+
+}
@@ -48,6 +48,7 @@ namespace fs = ghc::filesystem;
 namespace emu {
 
 class Chip8Compiler;
+class SourceCache;
 
 struct SourceLocation {
     std::string file;
@@ -157,6 +158,10 @@ public:
     void generateLineInfos(bool value) { _generateLineInfos = value; }
     void setIncludePaths(const std::vector<std::string>& paths);
     void setProgressHandler(ProgressHandler handler) { _progress = handler; }
+    // source files and images are read through the given cache, it can be shared between compilers
+    void setSourceCache(std::shared_ptr<SourceCache> cache) { _sourceCache = std::move(cache); }
+    // all source files and images read since construction or the last reset(), in the order of first use
+    const std::vector<std::string>& dependencies() const { return _dependencies; }
     uint32_t codeSize() const;
     const uint8_t* code() const;
     const Sha1::Digest& sha1() const;
@@ -190,6 +195,7 @@ private:
     void flushSegment();
     static bool isRegister(const Token& token) ;
     std::string resolveFile(const fs::path& file);
+    void addDependency(const std::string& file);
     Mode _mode{eC_OCTO};
     std::ostringstream _collect;
     std::vector<std::pair<int,std::string>> _collectLocationStack;
@@ -207,6 +213,8 @@ private:
     static std::unordered_map<std::string_view, OpcodeList> _operators;
     static std::unordered_map<std::string_view, OpcodeList> _mnemonics;
     ProgressHandler _progress;
+    std::shared_ptr<SourceCache> _sourceCache;
+    std::vector<std::string> _dependencies;
     bool _generateLineInfos{true};
     int _startAddress{0x200};
     CompileResult _compileResult;
@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/opcodematcher.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace emu {
+
+// A set of opcode patterns (value/mask pairs like the ones from opcodeFromPattern and
+// maskFromPattern) compiled into a table with one entry per opcode, so finding all
+// patterns an opcode matches is a single table read, independent of the number of
+// patterns. The entries refer to the distinct sets of pattern indices, so the table stays
+// at 256k even for hundreds of patterns.
+class OpcodeMatcher
+{
+public:
+    using PatternList = std::vector<uint32_t>;
+    OpcodeMatcher()
+        : _table(0x10000, 0)
+        , _sets(1)
+    {
+    }
+
+    // Adds a pattern matching all opcodes with (opcode & mask) == value and returns its index.
+    uint32_t add(uint16_t value, uint16_t mask)
+    {
+        auto index = _numPatterns++;
+        std::unordered_map<uint32_t, uint32_t> extendedSets;
+        value &= mask;
+        // walks all opcodes that only differ from value in the bits not covered by mask
+        uint32_t opcode = value;
+        while(true) {
+            auto& entry = _table[opcode];
+            auto iter = extendedSets.find(entry);
+            if(iter == extendedSets.end()) {
+                auto patterns = _sets[entry];
+                patterns.push_back(index);
+                _sets.push_back(std::move(patterns));
+                iter = extendedSets.emplace(entry, uint32_t(_sets.size() - 1)).first;
+            }
+            entry = iter->second;
+            if((opcode | mask) == 0xFFFF)
+                break;
+            opcode = (((opcode | mask) + 1) & ~uint32_t(mask) & 0xFFFF) | value;
+        }
+        return index;
+    }
+
+    uint32_t size() const { return _numPatterns; }
+    bool empty() const { return !_numPatterns; }
+    bool matches(uint16_t opcode) const { return _table[opcode] != 0; }
+    // The indices of all patterns matching the opcode in the order they were added.
+    const PatternList& patterns(uint16_t opcode) const { return _sets[_table[opcode]]; }
+    // Opcodes with the same set id match exactly the same patterns, id 0 matches none.
+    uint32_t setId(uint16_t opcode) const { return _table[opcode]; }
+    uint32_t numSets() const { return uint32_t(_sets.size()); }
+    const PatternList& patternsOfSet(uint32_t id) const { return _sets[id]; }
+
+private:
+    std::vector<uint32_t> _table;
+    std::vector<PatternList> _sets;
+    uint32_t _numPatterns{0};
+};
+
+}
@@ -0,0 +1,163 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/sequencematcher.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/opcodematcher.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace emu {
+
+// Finds sequences of opcode patterns in a stream of opcodes with an Aho-Corasick automaton.
+// The input alphabet are the opcode classes of an OpcodeMatcher over all distinct sequence
+// elements, so overlapping patterns like F?29 and F029 still give a deterministic automaton
+// and every opcode costs two table reads, no matter how many sequences are searched.
+class SequenceMatcher
+{
+public:
+    struct Element
+    {
+        uint16_t value;
+        uint16_t mask;
+        bool operator<(const Element& other) const { return value < other.value || (value == other.value && mask < other.mask); }
+    };
+    using Sequence = std::vector<Element>;
+
+    // Adds a sequence and returns its index, must be called before compile().
+    uint32_t add(const Sequence& sequence)
+    {
+        _sequences.push_back(sequence);
+        for(const auto& element : sequence) {
+            if(_elementIds.emplace(element, uint32_t(_elementIds.size())).second)
+                _elements.add(element.value, element.mask);
+        }
+        return uint32_t(_sequences.size() - 1);
+    }
+
+    // Every element matching several opcode classes multiplies the states of the automaton,
+    // so wildcard heavy sequences can grow it exponentially. Returns false (and leaves the
+    // matcher empty) if its goto table would need more than MAX_TABLE_SIZE entries.
+    static constexpr size_t MAX_TABLE_SIZE = size_t(1) << 24;
+    bool compile()
+    {
+        _numClasses = _elements.numSets();
+        std::vector<std::vector<uint32_t>> classesOfElement(_elementIds.size());
+        for(uint32_t id = 1; id < _numClasses; ++id) {
+            for(auto element : _elements.patternsOfSet(id)) {
+                classesOfElement[element].push_back(id);
+            }
+        }
+        // build a trie over opcode classes, an element matching several classes adds a branch for each
+        std::vector<std::map<uint32_t, uint32_t>> trie(1);
+        _matches.assign(1, {});
+        for(uint32_t index = 0; index < _sequences.size(); ++index) {
+            const auto& sequence = _sequences[index];
+            if(sequence.empty())
+                continue;
+            std::vector<std::pair<uint32_t, size_t>> pending{{0, 0}};
+            while(!pending.empty()) {
+                auto [state, pos] = pending.back();
+                pending.pop_back();
+                if(pos == sequence.size()) {
+                    _matches[state].push_back(index);
+                    continue;
+                }
+                for(auto cls : classesOfElement[_elementIds.at(sequence[pos])]) {
+                    auto iter = trie[state].find(cls);
+                    if(iter == trie[state].end()) {
+                        if((trie.size() + 1) * _numClasses > MAX_TABLE_SIZE) {
+                            _sequences.clear();
+                            _matches.clear();
+                            _goto.clear();
+                            return false;
+                        }
+                        iter = trie[state].emplace(cls, uint32_t(trie.size())).first;
+                        trie.emplace_back();
+                        _matches.emplace_back();
+                    }
+                    pending.emplace_back(iter->second, pos + 1);
+                }
+            }
+        }
+        // breadth first over the trie, filling the goto table from the failure links
+        _goto.assign(trie.size() * _numClasses, 0);
+        std::vector<uint32_t> failure(trie.size(), 0);
+        std::deque<uint32_t> queue;
+        for(const auto& [cls, child] : trie[0]) {
+            _goto[cls] = child;
+            queue.push_back(child);
+        }
+        while(!queue.empty()) {
+            auto state = queue.front();
+            queue.pop_front();
+            auto fail = failure[state];
+            _matches[state].insert(_matches[state].end(), _matches[fail].begin(), _matches[fail].end());
+            for(uint32_t cls = 0; cls < _numClasses; ++cls) {
+                auto iter = trie[state].find(cls);
+                if(iter != trie[state].end()) {
+                    failure[iter->second] = _goto[fail * _numClasses + cls];
+                    _goto[state * _numClasses + cls] = iter->second;
+                    queue.push_back(iter->second);
+                }
+                else {
+                    _goto[state * _numClasses + cls] = _goto[fail * _numClasses + cls];
+                }
+            }
+        }
+        return true;
+    }
+
+    bool empty() const { return _sequences.empty(); }
+    uint32_t size() const { return uint32_t(_sequences.size()); }
+    const Sequence& sequence(uint32_t index) const { return _sequences[index]; }
+    size_t maxLength() const
+    {
+        size_t length = 0;
+        for(const auto& sequence : _sequences) {
+            length = std::max(length, sequence.size());
+        }
+        return length;
+    }
+    static constexpr uint32_t start() { return 0; }
+    uint32_t next(uint32_t state, uint16_t opcode) const { return _goto[state * _numClasses + _elements.setId(opcode)]; }
+    // The indices of all sequences ending with the opcode that lead to this state.
+    const std::vector<uint32_t>& matches(uint32_t state) const { return _matches[state]; }
+
+private:
+    std::vector<Sequence> _sequences;
+    std::map<Element, uint32_t> _elementIds;
+    OpcodeMatcher _elements;
+    uint32_t _numClasses{0};
+    std::vector<uint32_t> _goto;
+    std::vector<std::vector<uint32_t>> _matches;
+};
+
+}
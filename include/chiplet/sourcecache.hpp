@@ -0,0 +1,94 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/sourcecache.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/sha1.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace emu {
+
+// Keeps the content of source files and the decoded pixels of included images between
+// compiles, so a long running process only reads them again when they changed. Every
+// lookup compares size and modification time of the file with the cached entry. As a
+// same-length edit within the timestamp granularity keeps both, entries whose file was
+// modified less than RACY_WINDOW before they were last checked are only trusted after
+// comparing a digest of the file content. Lookups can be done from multiple threads, the
+// returned content is immutable.
+class SourceCache
+{
+public:
+    struct Image
+    {
+        int width{0};
+        int height{0};
+        std::vector<uint8_t> pixels; // one byte per pixel, row by row
+    };
+    std::shared_ptr<const std::string> text(const std::string& file);
+    std::shared_ptr<const Image> image(const std::string& file);
+    void clear();
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+    // uncached loading, an unreadable file gives an empty text or no image
+    static std::shared_ptr<const std::string> loadText(const std::string& file);
+    static std::shared_ptr<const Image> loadImage(const std::string& file);
+
+private:
+    struct FileKey
+    {
+        uint64_t size{};
+        int64_t mtime{};
+        bool operator==(const FileKey& other) const { return size == other.size && mtime == other.mtime; }
+    };
+    template <typename T>
+    struct Entry
+    {
+        FileKey key;
+        Sha1::Digest digest;
+        int64_t checked{}; // file clock time the content was last read or verified
+        std::shared_ptr<const T> content;
+    };
+    static constexpr std::chrono::seconds RACY_WINDOW{2};
+    static bool fileKey(const std::string& file, FileKey& key);
+    static int64_t fileClockNow();
+    static std::shared_ptr<const Image> decodeImage(const std::string& data);
+    template <typename T, typename Decoder>
+    std::shared_ptr<const T> lookup(std::unordered_map<std::string, Entry<T>>& entries, const std::string& file, Decoder decode);
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, Entry<std::string>> _texts;
+    std::unordered_map<std::string, Entry<Image>> _images;
+    uint64_t _hits{0};
+    uint64_t _misses{0};
+};
+
+}
@@ -0,0 +1,202 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/tarreader.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/mappedfile.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+
+namespace emu {
+
+// Walks the entries of an uncompressed tar archive (v7, ustar, pax and GNU long names)
+// in a memory buffer, handing out views of the file contents without copying them.
+// Only regular files are returned, everything else is skipped.
+class TarReader
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 512;
+    struct Entry
+    {
+        std::string name;
+        ByteView data;
+    };
+    explicit TarReader(ByteView archive)
+        : _archive(archive)
+    {
+    }
+    bool error() const { return _error; }
+    bool next(Entry& entry)
+    {
+        std::string longName;
+        std::string paxPath;
+        int64_t paxSize = -1;
+        while(!_error && _offset + BLOCK_SIZE <= _archive.size()) {
+            const auto* header = _archive.data() + _offset;
+            if(isZeroBlock(header))
+                return false;
+            if(!validChecksum(header))
+                return fail();
+            auto size = paxSize >= 0 ? uint64_t(paxSize) : parseNumber(header + 124, 12);
+            auto dataOffset = _offset + BLOCK_SIZE;
+            if(size > _archive.size() - dataOffset)
+                return fail();
+            ByteView data{_archive.data() + dataOffset, size_t(size)};
+            _offset = dataOffset + (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+            auto type = char(header[156]);
+            switch(type) {
+                case 'x':
+                    if(!parsePaxRecords(data, paxPath, paxSize))
+                        return fail();
+                    continue;
+                case 'L':
+                    longName = fieldString(data.data(), data.size());
+                    continue;
+                case '0':
+                case '\0':
+                case '7':
+                    if(!paxPath.empty())
+                        entry.name = paxPath;
+                    else if(!longName.empty())
+                        entry.name = longName;
+                    else {
+                        entry.name = fieldString(header, 100);
+                        if(std::memcmp(header + 257, "ustar", 5) == 0 && header[345])
+                            entry.name = fieldString(header + 345, 155) + "/" + entry.name;
+                    }
+                    entry.data = data;
+                    return true;
+                default:
+                    // directories, links, devices, global pax headers...
+                    longName.clear();
+                    paxPath.clear();
+                    paxSize = -1;
+                    continue;
+            }
+        }
+        return false;
+    }
+
+private:
+    bool fail()
+    {
+        _error = true;
+        return false;
+    }
+    static bool isZeroBlock(const uint8_t* block)
+    {
+        for(size_t i = 0; i < BLOCK_SIZE; ++i) {
+            if(block[i])
+                return false;
+        }
+        return true;
+    }
+    static bool validChecksum(const uint8_t* header)
+    {
+        uint64_t sum = 0;
+        for(size_t i = 0; i < BLOCK_SIZE; ++i) {
+            sum += (i >= 148 && i < 156) ? uint8_t(' ') : header[i];
+        }
+        return sum == parseNumber(header + 148, 8);
+    }
+    static uint64_t parseNumber(const uint8_t* field, size_t length)
+    {
+        uint64_t value = 0;
+        if(field[0] & 0x80) {
+            // GNU base-256 encoding for big values
+            value = field[0] & 0x7f;
+            for(size_t i = 1; i < length; ++i) {
+                value = (value << 8) | field[i];
+            }
+            return value;
+        }
+        size_t i = 0;
+        while(i < length && field[i] == ' ')
+            ++i;
+        for(; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+            value = (value << 3) | uint64_t(field[i] - '0');
+        }
+        return value;
+    }
+    static std::string fieldString(const uint8_t* field, size_t length)
+    {
+        auto* end = static_cast<const uint8_t*>(std::memchr(field, 0, length));
+        return std::string(reinterpret_cast<const char*>(field), end ? size_t(end - field) : length);
+    }
+    // parses a string of decimal digits, fails on anything else or values above maxValue
+    static bool parseDecimal(std::string_view text, uint64_t maxValue, uint64_t& value)
+    {
+        value = 0;
+        if(text.empty())
+            return false;
+        for(auto c : text) {
+            if(c < '0' || c > '9')
+                return false;
+            auto digit = uint64_t(c - '0');
+            if(value > (maxValue - digit) / 10)
+                return false;
+            value = value * 10 + digit;
+        }
+        return true;
+    }
+    static bool parsePaxRecords(ByteView data, std::string& path, int64_t& size)
+    {
+        // records are "<length> <key>=<value>\n", with length including itself
+        std::string_view records(reinterpret_cast<const char*>(data.data()), data.size());
+        while(!records.empty()) {
+            auto space = records.find(' ');
+            if(space == std::string_view::npos)
+                return true;
+            uint64_t length = 0;
+            if(!parseDecimal(records.substr(0, space), records.size(), length) || length <= space + 1)
+                return true;
+            auto record = records.substr(space + 1, size_t(length) - space - 2);
+            auto equals = record.find('=');
+            if(equals != std::string_view::npos) {
+                auto key = record.substr(0, equals);
+                auto value = record.substr(equals + 1);
+                if(key == "path")
+                    path = std::string(value);
+                else if(key == "size") {
+                    uint64_t paxSize = 0;
+                    if(!parseDecimal(value, uint64_t(std::numeric_limits<int64_t>::max()), paxSize))
+                        return false;
+                    size = int64_t(paxSize);
+                }
+            }
+            records.remove_prefix(size_t(length));
+        }
+        return true;
+    }
+    ByteView _archive;
+    size_t _offset{0};
+    bool _error{false};
+};
+
+}
@@ -0,0 +1,168 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/trace.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+// Scoped timing spans written as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Without CHIPLET_WITH_TRACE the CHIPLET_TRACE_SPAN macro expands to nothing, not even its
+// arguments are evaluated. With it, a span costs a relaxed atomic load as long as no trace
+// is being recorded.
+#if defined(CHIPLET_WITH_TRACE)
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ghc {
+
+class Trace
+{
+public:
+    static Trace& instance()
+    {
+        static Trace trace;
+        return trace;
+    }
+    void start()
+    {
+        _origin = std::chrono::steady_clock::now();
+        _recording.store(true, std::memory_order_release);
+    }
+    bool recording() const { return _recording.load(std::memory_order_relaxed); }
+    int64_t now() const { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _origin).count(); }
+    void add(const char* name, std::string detail, int64_t start, int64_t end)
+    {
+        auto thread = threadId();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _events.push_back({name, std::move(detail), start, end - start, thread});
+    }
+    bool write(const std::string& file) const
+    {
+        auto events = nlohmann::json::array();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(const auto& event : _events) {
+                nlohmann::json record = {{"name", event.name}, {"cat", "chiplet"}, {"ph", "X"}, {"ts", event.start}, {"dur", event.duration}, {"pid", 1}, {"tid", event.thread}};
+                if(!event.detail.empty())
+                    record["args"] = {{"detail", event.detail}};
+                events.push_back(std::move(record));
+            }
+        }
+        std::ofstream out(file);
+        out << nlohmann::json{{"traceEvents", events}, {"displayTimeUnit", "ms"}}.dump() << std::endl;
+        return out.good();
+    }
+
+private:
+    struct Event
+    {
+        const char* name;
+        std::string detail;
+        int64_t start;
+        int64_t duration;
+        uint32_t thread;
+    };
+    static uint32_t threadId()
+    {
+        static std::atomic<uint32_t> nextId{1};
+        thread_local uint32_t id = nextId++;
+        return id;
+    }
+    std::atomic<bool> _recording{false};
+    std::chrono::steady_clock::time_point _origin{std::chrono::steady_clock::now()};
+    mutable std::mutex _mutex;
+    std::vector<Event> _events;
+};
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name)
+        : _name(Trace::instance().recording() ? name : nullptr)
+    {
+        if(_name)
+            _start = Trace::instance().now();
+    }
+    TraceSpan(const char* name, const std::string& detail)
+        : TraceSpan(name)
+    {
+        if(_name)
+            _detail = detail;
+    }
+    ~TraceSpan()
+    {
+        if(_name)
+            Trace::instance().add(_name, std::move(_detail), _start, Trace::instance().now());
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* _name;
+    std::string _detail;
+    int64_t _start{0};
+};
+
+// Records spans while it lives and writes them to the given file when destroyed, nothing
+// is recorded for an empty file name.
+class TraceRecording
+{
+public:
+    explicit TraceRecording(std::string file)
+        : _file(std::move(file))
+    {
+        if(!_file.empty())
+            Trace::instance().start();
+    }
+    ~TraceRecording()
+    {
+        if(!_file.empty() && !Trace::instance().write(_file))
+            std::cerr << "ERROR: Couldn't write trace file '" << _file << "'" << std::endl;
+    }
+    TraceRecording(const TraceRecording&) = delete;
+    TraceRecording& operator=(const TraceRecording&) = delete;
+
+private:
+    std::string _file;
+};
+
+}
+
+#define CHIPLET_TRACE_CONCAT_(a, b) a##b
+#define CHIPLET_TRACE_CONCAT(a, b) CHIPLET_TRACE_CONCAT_(a, b)
+#define CHIPLET_TRACE_SPAN(...) ghc::TraceSpan CHIPLET_TRACE_CONCAT(traceSpan_, __LINE__)(__VA_ARGS__)
+
+#else
+
+#define CHIPLET_TRACE_SPAN(...) do {} while(false)
+
+#endif
@@ -27,6 +27,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <new>
 #include <sstream>
@@ -262,6 +263,37 @@ inline Sha1::Digest calculateSha1(const std::string& str)
     return static_cast<Sha1::Digest>(sum);;
 }
 
+// The murmur3 64-bit finalizer, scrambles all bits of a value into all bits of the result.
+inline uint64_t mixHash64(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// A fast non-cryptographic 64-bit hash, meant to bucket content before paying for
+// a SHA-1. It consumes 8 bytes per round and finishes with the murmur3 finalizer.
+inline uint64_t fastHash64(const uint8_t* data, size_t size)
+{
+    constexpr uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = size * prime;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    for(size_t shift = 0; i < size; ++i, shift += 8) {
+        tail |= uint64_t(data[i]) << shift;
+    }
+    return mixHash64((hash ^ tail) * prime);
+}
+
 inline bool fuzzyCompare(std::string_view s1, std::string_view s2)
 {
     auto iter1 = s1.begin();
@@ -0,0 +1,170 @@
+//---------------------------------------------------------------------------------------
+// include/chiplet/workstealingpool.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ghc {
+
+// A small thread pool where every worker owns a task queue. Tasks are distributed
+// round-robin on submit, a worker takes from the front of its own queue and steals
+// from the back of the others when it runs dry. With zero threads, tasks are executed
+// inline on submit, so callers don't need a separate sequential code path.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkStealingPool(size_t numThreads)
+    {
+        for(size_t i = 0; i < numThreads; ++i) {
+            _queues.push_back(std::make_unique<Queue>());
+        }
+        for(size_t i = 0; i < numThreads; ++i) {
+            _threads.emplace_back([this, i]() { run(i); });
+        }
+    }
+    ~WorkStealingPool()
+    {
+        wait();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeup.notify_all();
+        for(auto& thread : _threads) {
+            thread.join();
+        }
+    }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t size() const { return _threads.size(); }
+
+    std::future<void> submit(Task task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+        auto result = packaged->get_future();
+        if(_threads.empty()) {
+            (*packaged)();
+            return result;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_queued;
+            ++_pending;
+        }
+        auto& queue = *_queues[_nextQueue++ % _queues.size()];
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.tasks.emplace_back([packaged]() { (*packaged)(); });
+        }
+        _wakeup.notify_one();
+        return result;
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return _pending == 0; });
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    bool popOrSteal(size_t self, Task& task)
+    {
+        {
+            auto& own = *_queues[self];
+            std::unique_lock<std::mutex> lock(own.mutex);
+            if(!own.tasks.empty()) {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for(size_t i = 1; i < _queues.size(); ++i) {
+            auto& victim = *_queues[(self + i) % _queues.size()];
+            std::unique_lock<std::mutex> lock(victim.mutex);
+            if(!victim.tasks.empty()) {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+    void run(size_t self)
+    {
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wakeup.wait(lock, [this]() { return _queued > 0 || _stop; });
+                if(_stop && _queued <= 0)
+                    return;
+            }
+            Task task;
+            if(!popOrSteal(self, task)) {
+                // counted but not yet pushed by submit, try again
+                std::this_thread::yield();
+                continue;
+            }
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                --_queued;
+            }
+            task();
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if(--_pending == 0)
+                    _done.notify_all();
+            }
+        }
+    }
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::condition_variable _done;
+    int64_t _queued{0};
+    int64_t _pending{0};
+    std::atomic<size_t> _nextQueue{0};
+    bool _stop{false};
+};
+
+}
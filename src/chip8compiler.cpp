@@ -2,6 +2,7 @@
 //#include <emulation/utility.hpp>
 
 #include <chiplet/sha1.hpp>
+#include <chiplet/trace.hpp>
 #include <iostream>
 #include <vector>
 
@@ -32,6 +33,7 @@ Chip8Compiler::~Chip8Compiler()
 
 bool Chip8Compiler::compile(std::string_view text, int startAddress)
 {
+    CHIPLET_TRACE_SPAN("Chip8Compiler::compile");
     if (_impl->_program) {
         _impl->_program.reset();
     }
@@ -120,6 +122,7 @@ const char* Chip8Compiler::breakpointForAddr(uint32_t addr) const
 
 void Chip8Compiler::updateHash()
 {
+    CHIPLET_TRACE_SPAN("sha1");
     char hex[SHA1_HEX_SIZE];
     char bpName[1024];
     Sha1 sum;
@@ -136,6 +139,7 @@ void Chip8Compiler::updateHash()
 
 void Chip8Compiler::updateLineCoverage()
 {
+    CHIPLET_TRACE_SPAN("line coverage");
     _impl->_lineCoverage.clear();
     _impl->_lineCoverage.resize(_impl->_program->numSourceLines());
     if (!_impl->_program)
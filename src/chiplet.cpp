@@ -26,11 +26,29 @@
 
 #include <chiplet/octocompiler.hpp>
 #include <chiplet/chip8decompiler.hpp>
+#include <chiplet/chip8classifier.hpp>
 
 #include <chiplet/utility.hpp>
 #include <chiplet/cli.hpp>
 #include <chiplet/sha1.hpp>
 #include <chiplet/octocartridge.hpp>
+#include <chiplet/mappedfile.hpp>
+#include <chiplet/tarreader.hpp>
+#include <chiplet/workstealingpool.hpp>
+#include <chiplet/latencyhistogram.hpp>
+#include <chiplet/opcodematcher.hpp>
+#include <chiplet/sequencematcher.hpp>
+#include <chiplet/trace.hpp>
+
+#include "compileserver.hpp"
+#include "filewatcher.hpp"
+#include "manifest.hpp"
+#include "manifestquery.hpp"
+#include "multibuild.hpp"
+#include "opcodeindex.hpp"
+#include "romclusters.hpp"
+#include "scancache.hpp"
+#include "subroutineindex.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <chiplet/stb_image.h>
@@ -38,37 +56,302 @@
 #include <nlohmann/json.hpp>
 
 #include <chrono>
+#include <deque>
+#include <limits>
+#include <mutex>
 #include <set>
 #include <stdexcept>
+#include <thread>
 
-enum WorkMode { ePREPROCESS, eCOMPILE, eDISASSEMBLE, eANALYSE, eSEARCH, eDEEP_ANALYSE };
-static std::unordered_map<std::string, std::string> fileMap;
+enum WorkMode { ePREPROCESS, eCOMPILE, eDISASSEMBLE, eANALYSE, eSEARCH, eFIND_SEQUENCE, eSHARED_SUBROUTINES, eCLUSTER, eDEEP_ANALYSE };
 static std::vector<std::string> opcodesToFind;
+static emu::OpcodeMatcher findMatcher;
+static std::vector<std::string> sequencesToFind;
+static emu::SequenceMatcher sequenceMatcher;
 static std::string outputFile;
+static std::string mismatchDir;
 static bool fullPath = false;
 static bool withUsage = false;
 static bool genListing = false;
 static int foundFiles = 0;
 static bool roundTrip = false;
+static bool ndjson = false;
 static int errors = 0;
 static int64_t totalSourceLines = 0;
 static int64_t totalDecompileTime_us = 0;
 static int64_t totalAssembleTime_us = 0;
+static ghc::LatencyHistogram decompileLatency;
+static ghc::LatencyHistogram assembleLatency;
+static ghc::LatencyHistogram compareLatency;
+static std::map<uint16_t, int> totalStats;
+
+// Everything a single file contributes to the output and the summary, buffered so files
+// can be worked on in parallel and still be reported in input order.
+struct WorkResult
+{
+    struct SequenceMatch
+    {
+        uint32_t address;
+        uint32_t sequence;
+        std::string opcodes;
+    };
+    std::ostringstream out;
+    std::ostringstream err;
+    std::ostringstream log;
+    int errors{0};
+    int foundFiles{0};
+    int64_t sourceLines{0};
+    int64_t decompileTime_us{0};
+    int64_t assembleTime_us{0};
+    int64_t compareTime_us{0};
+    std::map<uint16_t, int> stats;
+    std::vector<std::string> foundPatterns;
+    std::vector<SequenceMatch> foundSequences;
+    std::vector<emu::SubroutineIndex::Fingerprint> subroutines;
+    std::optional<emu::RomClusters::Signature> signature;
+    std::vector<std::string> errorMessages;
+    emu::RomAnalysis analysis;
+    bool cached{false};
+};
 
+// Keeps the N round-trip files with the highest total time, in constant memory.
+class SlowestFiles
+{
+public:
+    struct Entry
+    {
+        int64_t total_us;
+        int64_t decompile_us;
+        int64_t assemble_us;
+        int64_t compare_us;
+        std::string file;
+        bool operator<(const Entry& other) const { return total_us > other.total_us; }
+    };
+    explicit SlowestFiles(size_t maxEntries)
+        : _maxEntries(maxEntries)
+    {
+    }
+    void add(const std::string& file, int64_t decompile_us, int64_t assemble_us, int64_t compare_us)
+    {
+        auto total = decompile_us + assemble_us + compare_us;
+        if(!_maxEntries || (_entries.size() == _maxEntries && total <= _entries.front().total_us))
+            return;
+        if(_entries.size() == _maxEntries) {
+            std::pop_heap(_entries.begin(), _entries.end());
+            _entries.pop_back();
+        }
+        _entries.push_back({total, decompile_us, assemble_us, compare_us, file});
+        std::push_heap(_entries.begin(), _entries.end());
+    }
+    std::vector<Entry> sorted() const
+    {
+        auto result = _entries;
+        std::sort_heap(result.begin(), result.end());
+        return result;
+    }
+private:
+    size_t _maxEntries;
+    std::vector<Entry> _entries;
+};
+
+// Collects complete lines and hands them to the stream in big blocks, so a run over
+// many files doesn't pay for a flush per line.
+class BufferedWriter
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    explicit BufferedWriter(std::ostream& os)
+        : _os(os)
+    {
+        _buffer.reserve(BUFFER_SIZE);
+    }
+    ~BufferedWriter() { flush(); }
+    void writeLine(const std::string& line)
+    {
+        _buffer += line;
+        _buffer += '\n';
+        if(_buffer.size() >= BUFFER_SIZE)
+            flush();
+    }
+    void flush()
+    {
+        CHIPLET_TRACE_SPAN("output");
+        _os.write(_buffer.data(), std::streamsize(_buffer.size()));
+        _os.flush();
+        _buffer.clear();
+    }
+private:
+    std::ostream& _os;
+    std::string _buffer;
+};
 
 std::string fileOrPath(const std::string& file)
 {
     return fullPath ? file : fs::path(file).filename().string();
 }
 
-void workFile(WorkMode mode, const std::string& file, const std::vector<uint8_t>& data)
+uint16_t romStartAddress(const std::string& file)
+{
+    return endsWith(file, ".c8x") ? 0x300 : 0x200;
+}
+
+std::vector<std::string> variantNames(emu::Chip8Variant variants)
+{
+    constexpr auto allowedVariants = (emu::C8V::CHIP_8 | emu::C8V::CHIP_8X | emu::C8V::CHIP_8X_TPD | emu::C8V::HI_RES_CHIP_8X | emu::C8V::CHIP_10 | emu::C8V::CHIP_48 | emu::C8V::SCHIP_1_0 | emu::C8V::SCHIP_1_1 | emu::C8V::MEGA_CHIP | emu::C8V::XO_CHIP);
+    std::vector<std::string> names;
+    auto mask = static_cast<uint64_t>(variants & allowedVariants);
+    while(mask) {
+        auto cv = static_cast<emu::Chip8Variant>(mask & -mask);
+        mask &= mask - 1;
+        names.push_back(emu::Chip8Decompiler::chipVariantName(cv).first);
+    }
+    return names;
+}
+
+void reportAnalysis(const std::string& file, const emu::RomAnalysis& analysis, std::ostream& out)
+{
+    out << "    " << fileOrPath(file) << ", " << analysis.stats.size() << " opcodes used";
+    if((uint64_t)analysis.possibleVariants) {
+        bool first = true;
+        for(const auto& name : variantNames(analysis.possibleVariants)) {
+            out << (first ? ", possible variants: " : ", ") << name;
+            first = false;
+        }
+        out << std::endl;
+    }
+    else {
+        out << ", doesn't seem to be supported by any know variant." << std::endl;
+    }
+    if(analysis.usesOddPcAddress)
+        out << "    Uses odd PC access." << std::endl;
+}
+
+// Compiles the -f patterns into findMatcher, like comparePattern only the first four
+// characters count and missing ones match anything.
+void compileFindPatterns()
+{
+    for(const auto& pattern : opcodesToFind) {
+        auto normalized = (pattern + "????").substr(0, 4);
+        findMatcher.add(opcodeFromPattern(normalized), maskFromPattern(normalized));
+    }
+}
+
+// Returns which of the -f patterns are matched by any of the used opcodes.
+std::vector<bool> matchFindPatterns(const std::map<uint16_t, int>& fullStats)
+{
+    std::vector<bool> matched(findMatcher.size(), false);
+    for(const auto& [opcode, count] : fullStats) {
+        for(auto index : findMatcher.patterns(opcode)) {
+            matched[index] = true;
+        }
+    }
+    return matched;
+}
+
+// Compiles the --find-seq arguments into sequenceMatcher, returns an error message if
+// a sequence is empty or they are too ambiguous to be searched.
+std::string compileFindSequences()
+{
+    for(const auto& text : sequencesToFind) {
+        emu::SequenceMatcher::Sequence sequence;
+        std::istringstream is(text);
+        std::string pattern;
+        while(is >> pattern) {
+            auto normalized = (pattern + "????").substr(0, 4);
+            sequence.push_back({opcodeFromPattern(normalized), maskFromPattern(normalized)});
+        }
+        if(sequence.empty())
+            return "Empty sequence given to --find-seq";
+        sequenceMatcher.add(sequence);
+    }
+    if(!sequenceMatcher.compile())
+        return "The sequences given to --find-seq have too many wildcards to be searched";
+    return {};
+}
+
+void reportSearch(const std::string& file, const std::map<uint16_t, int>& fullStats, WorkResult& result)
+{
+    bool found = false;
+    auto matched = matchFindPatterns(fullStats);
+    for(size_t i = 0; i < matched.size(); ++i) {
+        if(matched[i]) {
+            if (found)
+                result.out << ", ";
+            result.out << opcodesToFind[i];
+            result.foundPatterns.push_back(opcodesToFind[i]);
+            found = true;
+        }
+    }
+    if(found) {
+        ++result.foundFiles;
+        result.out << ": " << fileOrPath(file) << std::endl;
+    }
+}
+
+void storeAnalysis(const emu::Chip8Decompiler& dec, emu::RomAnalysis& analysis)
+{
+    analysis.analysed = true;
+    analysis.possibleVariants = dec.possibleVariants();
+    analysis.usesOddPcAddress = dec.usesOddPcAddress();
+    analysis.codeBytes = dec.codeSize();
+    analysis.stats = {dec.stats().begin(), dec.stats().end()};
+    analysis.fullStats = {dec.fullStats().begin(), dec.fullStats().end()};
+}
+
+// Answers a file from a cached analysis if that has everything the mode needs.
+bool reportCached(WorkMode mode, const std::string& file, const emu::RomAnalysis& analysis, WorkResult& result)
+{
+    switch(mode) {
+        case eANALYSE:
+            if(!analysis.analysed)
+                return false;
+            reportAnalysis(file, analysis, result.out);
+            result.stats = analysis.stats;
+            return true;
+        case eSEARCH:
+            if(withUsage || !analysis.analysed)
+                return false;
+            reportSearch(file, analysis.fullStats, result);
+            return true;
+        case eDISASSEMBLE:
+            if(!roundTrip || analysis.roundTrip != emu::RomAnalysis::ePASSED)
+                return false;
+            result.sourceLines += analysis.sourceLines;
+            result.log << "    " << fileOrPath(file) << " [cached]" << std::endl;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Keeps the decompiled source and the assembled binary of a failed round trip for
+// inspection, if a directory for them was given.
+void writeMismatch(const std::string& file, const std::string& source, const uint8_t* code, size_t size)
+{
+    if(mismatchDir.empty())
+        return;
+    auto name = fs::path(file).filename();
+    auto sourceFile = (fs::path(mismatchDir) / name).replace_extension(".8o").string();
+    writeFile(sourceFile, source.data(), source.size());
+    if(code && size)
+        writeFile((fs::path(mismatchDir) / name).string(), code, size);
+}
+
+void workFile(WorkMode mode, const std::string& file, emu::ByteView data, WorkResult& result)
 {
     if(data.empty())
         return;
 
-    constexpr auto allowedVariants = (emu::C8V::CHIP_8 | emu::C8V::CHIP_8X | emu::C8V::CHIP_8X_TPD | emu::C8V::HI_RES_CHIP_8X | emu::C8V::CHIP_10 | emu::C8V::CHIP_48 | emu::C8V::SCHIP_1_0 | emu::C8V::SCHIP_1_1 | emu::C8V::MEGA_CHIP | emu::C8V::XO_CHIP);
-    uint16_t startAddress = endsWith(file, ".c8x") ? 0x300 : 0x200;
+    uint16_t startAddress = romStartAddress(file);
+    result.analysis.startAddress = startAddress;
     emu::Chip8Decompiler dec;
+    auto roundTripError = [&](const std::string& message) {
+        result.err << "    " << fileOrPath(file) << ": " << message << std::endl;
+        result.errorMessages.push_back(message);
+        workFile(eANALYSE, file, data, result);
+        result.analysis.roundTrip = emu::RomAnalysis::eFAILED;
+        ++result.errors;
+    };
     switch(mode) {
         case eDISASSEMBLE:
             if(roundTrip) {
@@ -77,6 +360,8 @@ void workFile(WorkMode mode, const std::string& file, const std::vector<uint8_t>
                 auto decStart = std::chrono::steady_clock::now();
                 dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &os, false, true);
                 auto decEnd = std::chrono::steady_clock::now();
+                result.analysis.possibleVariants = dec.possibleVariants();
+                result.analysis.usesOddPcAddress = dec.usesOddPcAddress();
                 if(dec.possibleVariants() == emu::C8V::CHIP_8X || dec.possibleVariants() == emu::C8V::HI_RES_CHIP_8X)
                     startAddress = 0x300;
                 else if(dec.possibleVariants() == emu::C8V::CHIP_8X_TPD)
@@ -87,36 +372,37 @@ void workFile(WorkMode mode, const std::string& file, const std::vector<uint8_t>
                 comp.setStartAddress(startAddress);
                 if(comp.compile(file, source.data(), source.data() + source.size(), false).resultType == emu::CompileResult::eOK) {
                     auto compEnd = std::chrono::steady_clock::now();
-                    if(comp.codeSize() != data.size()) {
-                        std::cerr << "    " << fileOrPath(file) << ": Compiled size doesn't match! (" << data.size() << " bytes)" << std::endl;
-                        workFile(eANALYSE, file, data);
-                        writeFile(fs::path(file).filename().string().c_str(), comp.code(), comp.codeSize());
-                        ++errors;
+                    bool sizeMatches = comp.codeSize() == data.size();
+                    bool codeMatches = sizeMatches && comp.sha1() == calculateSha1(data.data(), data.size());
+                    auto compareEnd = std::chrono::steady_clock::now();
+                    if(!sizeMatches) {
+                        roundTripError(fmt::format("Compiled size doesn't match! ({} bytes)", data.size()));
+                        writeMismatch(file, source, comp.code(), comp.codeSize());
                     }
-                    else if(comp.sha1() != calculateSha1(data.data(), data.size())) {
-                        std::cerr << "    " << fileOrPath(file) << ": Compiled code doesn't match! (" << data.size() << " bytes)" << std::endl;
-                        workFile(eANALYSE, file, data);
-                        writeFile(fs::path(file).filename().string().c_str(), comp.code(), comp.codeSize());
-                        ++errors;
+                    else if(!codeMatches) {
+                        roundTripError(fmt::format("Compiled code doesn't match! ({} bytes)", data.size()));
+                        writeMismatch(file, source, comp.code(), comp.codeSize());
                     }
                     else {
-                        totalSourceLines += comp.numSourceLines();
+                        result.sourceLines += comp.numSourceLines();
+                        result.analysis.roundTrip = emu::RomAnalysis::ePASSED;
+                        result.analysis.sourceLines = comp.numSourceLines();
                         auto decompTime = std::chrono::duration_cast<std::chrono::microseconds>(decEnd - decStart).count();
                         auto assemTime = std::chrono::duration_cast<std::chrono::microseconds>(compEnd - decEnd).count();
-                        totalDecompileTime_us += decompTime;
-                        totalAssembleTime_us += assemTime;
-                        std::clog << "    " << fileOrPath(file) << " [" << decompTime << "us/" << assemTime << "us]" << std::endl;
+                        result.decompileTime_us += decompTime;
+                        result.assembleTime_us += assemTime;
+                        result.compareTime_us += std::chrono::duration_cast<std::chrono::microseconds>(compareEnd - compEnd).count();
+                        result.log << "    " << fileOrPath(file) << " [" << decompTime << "us/" << assemTime << "us]" << std::endl;
                     }
                 }
                 else {
-                    std::cerr << "    " << fileOrPath(file) << ": Source doesn't compile: " << comp.compileResult().errorMessage << std::endl;
-                    workFile(eANALYSE, file, data);
-                    ++errors;
+                    roundTripError("Source doesn't compile: " + comp.compileResult().errorMessage);
+                    writeMismatch(file, source, nullptr, 0);
                 }
             }
             else {
                 if(outputFile.empty())
-                    dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &std::cout);
+                    dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &result.out);
                 else {
                     std::ofstream out(outputFile);
                     dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &out);
@@ -124,53 +410,72 @@ void workFile(WorkMode mode, const std::string& file, const std::vector<uint8_t>
             }
             break;
         case eANALYSE:
-            std::cout << "    " << fileOrPath(file);
-            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &std::cout, true);
-            if((uint64_t)dec.possibleVariants()) {
-                auto mask = static_cast<uint64_t>(dec.possibleVariants() & allowedVariants);
-                bool first = true;
-                while(mask) {
-                    auto cv = static_cast<emu::Chip8Variant>(mask & -mask);
-                    mask &= mask - 1;
-                    std::cout << (first ? ", possible variants: " : ", ") << dec.chipVariantName(cv).first;
-                    first = false;
-                }
-                std::cout << std::endl;
-            }
-            else {
-                std::cout << ", doesn't seem to be supported by any know variant." << std::endl;
-            }
-            if(dec.usesOddPcAddress())
-                std::cout << "    Uses odd PC access." << std::endl;
+            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, nullptr, true, true);
+            storeAnalysis(dec, result.analysis);
+            reportAnalysis(file, result.analysis, result.out);
             break;
         case eSEARCH: {
-            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &std::cout, true, true);
-            bool found = false;
-            for (const auto& pattern : opcodesToFind) {
-                for (const auto& [opcode, count] : dec.fullStats()) {
-                    std::string hex = fmt::format("{:04X}", opcode);
-                    if (comparePattern(pattern, hex)) {
-                        if(withUsage) {
-                            if(!found)
-                                std::cout << fileOrPath(file) << ":" << std::endl;
-                            dec.listUsages(opcodeFromPattern(pattern), maskFromPattern(pattern), std::cout);
-                            found = true;
-                        }
-                        else {
-                            if (found)
-                                std::cout << ", ";
-                            std::cout << pattern;
-                            found = true;
-                            break;
-                        }
-                    }
+            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, &result.out, true, true);
+            storeAnalysis(dec, result.analysis);
+            if(!withUsage) {
+                reportSearch(file, result.analysis.fullStats, result);
+                break;
+            }
+            auto matched = matchFindPatterns(result.analysis.fullStats);
+            if(std::find(matched.begin(), matched.end(), true) == matched.end())
+                break;
+            std::vector<std::string> usages;
+            dec.listUsages(findMatcher, usages);
+            result.out << fileOrPath(file) << ":" << std::endl;
+            for(size_t i = 0; i < matched.size(); ++i) {
+                if(matched[i]) {
+                    result.out << usages[i];
+                    result.foundPatterns.push_back(opcodesToFind[i]);
                 }
             }
-            if(found) {
-                ++foundFiles;
-                if (!withUsage)
-                    std::cout << ": " << fileOrPath(file) << std::endl;
+            ++result.foundFiles;
+            break;
+        }
+        case eFIND_SEQUENCE: {
+            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, nullptr, true, true);
+            storeAnalysis(dec, result.analysis);
+            std::vector<bool> matched(sequenceMatcher.size(), false);
+            dec.findSequences(sequenceMatcher, [&](uint32_t address, uint32_t sequence, const std::vector<uint16_t>& opcodes) {
+                if(result.foundSequences.empty())
+                    result.out << fileOrPath(file) << ":" << std::endl;
+                std::string code;
+                for(auto opcode : opcodes) {
+                    code += fmt::format("{}{:04X}", code.empty() ? "" : " ", opcode);
+                }
+                result.out << fmt::format("    0x{:04X}: {} [{}]", address, sequencesToFind[sequence], code) << std::endl;
+                result.foundSequences.push_back({address, sequence, code});
+                matched[sequence] = true;
+            });
+            for(size_t i = 0; i < matched.size(); ++i) {
+                if(matched[i])
+                    result.foundPatterns.push_back(sequencesToFind[i]);
             }
+            if(!result.foundSequences.empty())
+                ++result.foundFiles;
+            break;
+        }
+        case eSHARED_SUBROUTINES:
+            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, nullptr, true, true);
+            storeAnalysis(dec, result.analysis);
+            dec.forEachCodeChunk(emu::Chip8Decompiler::eCALL, [&](uint32_t address, const std::vector<std::pair<uint16_t, int>>& code) {
+                result.subroutines.push_back(emu::SubroutineIndex::fingerprint(address, code));
+            });
+            break;
+        case eCLUSTER: {
+            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, nullptr, true, true);
+            storeAnalysis(dec, result.analysis);
+            std::vector<emu::RomClusters::Code> chunks;
+            dec.forEachCodeChunk(emu::Chip8Decompiler::eJUMP | emu::Chip8Decompiler::eCALL, [&](uint32_t, const emu::RomClusters::Code& code) {
+                chunks.push_back(code);
+            });
+            emu::RomClusters::Signature signature;
+            if(emu::RomClusters::signature(chunks, signature))
+                result.signature = signature;
             break;
         }
         case eDEEP_ANALYSE: {
@@ -182,29 +487,94 @@ void workFile(WorkMode mode, const std::string& file, const std::vector<uint8_t>
                     dec.setVariant(emu::Chip8Variant::MEGA_CHIP, true, true);
                 }
             }
+            dec.decompile(file, data.data(), startAddress, data.size(), startAddress, nullptr, true, true);
+            if((uint64_t)dec.possibleVariants()) {
+                storeAnalysis(dec, result.analysis);
+                reportAnalysis(file, result.analysis, result.out);
+                ++result.foundFiles;
+            }
+            break;
         }
         case ePREPROCESS:
         case eCOMPILE:
             // not handled here
             break;
     }
+    for(const auto& [opcode, count] : dec.stats()) {
+        result.stats[opcode] += count;
+    }
 }
 
-std::pair<bool, std::string> checkDouble(const std::string& file, const std::vector<uint8_t>& data)
+// Identifies content by size and a fast 64-bit hash, files with the same key are only
+// considered identical after comparing their SHA-1.
+struct ContentKey
+{
+    uint64_t size{0};
+    uint64_t hash{0};
+    bool operator==(const ContentKey& other) const { return size == other.size && hash == other.hash; }
+};
+
+struct ContentKeyHash
+{
+    size_t operator()(const ContentKey& key) const noexcept { return size_t(key.hash ^ (key.size * 0x9E3779B97F4A7C15ull)); }
+};
+
+// Remembers the first file seen for every content. The SHA-1 is only needed when two
+// files share a ContentKey, so it is either passed in or fetched through the given
+// function on collision, and the paths are stored once in a single string arena.
+class DuplicateIndex
 {
-    char hex[SHA1_HEX_SIZE];
-    Sha1 sum;
-    sum.add(data.data(), data.size());
-    sum.finalize();
-    sum.print_hex(hex);
-    std::string digest = hex;
-    auto iter = fileMap.find(digest);
-    if(iter == fileMap.end()) {
-        fileMap[digest] = file;
-        return {false,""};
+public:
+    using DigestFunction = std::function<Sha1::Digest(const std::string& file)>;
+    explicit DuplicateIndex(DigestFunction digestOf)
+        : _digestOf(std::move(digestOf))
+    {
     }
-    return {true, iter->second};
-}
+    std::optional<std::string> checkDouble(const std::string& file, const ContentKey& key, std::optional<Sha1::Digest>& digest)
+    {
+        auto [iter, inserted] = _firstEntry.try_emplace(key, uint32_t(_entries.size()));
+        if(!inserted) {
+            if(!digest)
+                digest = _digestOf(file);
+            for(auto index = iter->second; index != NONE; index = _entries[index].next) {
+                auto& entry = _entries[index];
+                if(!entry.hasDigest) {
+                    entry.digest = _digestOf(path(index));
+                    entry.hasDigest = true;
+                }
+                if(entry.digest == *digest)
+                    return path(index);
+            }
+        }
+        Entry entry;
+        entry.pathOffset = uint32_t(_paths.size());
+        entry.pathSize = uint32_t(file.size());
+        entry.next = inserted ? NONE : iter->second;
+        if(digest) {
+            entry.digest = *digest;
+            entry.hasDigest = true;
+        }
+        iter->second = uint32_t(_entries.size());
+        _entries.push_back(entry);
+        _paths += file;
+        return {};
+    }
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+    struct Entry
+    {
+        Sha1::Digest digest;
+        uint32_t pathOffset{0};
+        uint32_t pathSize{0};
+        uint32_t next{NONE};
+        bool hasDigest{false};
+    };
+    std::string path(uint32_t index) const { return _paths.substr(_entries[index].pathOffset, _entries[index].pathSize); }
+    DigestFunction _digestOf;
+    std::unordered_map<ContentKey, uint32_t, ContentKeyHash> _firstEntry;
+    std::vector<Entry> _entries;
+    std::string _paths;
+};
 
 bool isChipRom(const std::string& name)
 {
@@ -212,11 +582,564 @@ bool isChipRom(const std::string& name)
     return validExtensions.count(name) > 0;
 }
 
-int disassembleOrAnalyze(bool scan, bool dumpDoubles, std::vector<std::string>& inputList, WorkMode& mode)
+bool isTarArchive(const std::string& name)
+{
+    return name == ".tar";
+}
+
+// Tracks the lowest input index that has been seen for a content key, so workers can
+// skip files that are most likely reported as duplicates anyway. The final decision
+// is still made by DuplicateIndex in input order.
+class FirstSeenIndex
+{
+public:
+    bool claim(const ContentKey& key, size_t index)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto [iter, inserted] = _index.try_emplace(key, index);
+        if(inserted)
+            return true;
+        if(index < iter->second) {
+            iter->second = index;
+            return true;
+        }
+        return false;
+    }
+private:
+    std::mutex _mutex;
+    std::unordered_map<ContentKey, size_t, ContentKeyHash> _index;
+};
+
+struct ScanItem
+{
+    std::string file;
+    size_t sequence{0};
+    ContentKey content;
+    std::optional<Sha1::Digest> digest;
+    std::optional<emu::ScanCache::FileKey> fileKey;
+    std::shared_ptr<emu::MappedFile> archive;
+    emu::ByteView archiveData;
+    bool skipped{false};
+    bool rejected{false};
+    WorkResult result;
+    std::future<void> done;
+};
+
+nlohmann::json fileRecord(const ScanItem& item, const std::string& duplicateOf)
+{
+    nlohmann::json record = {{"path", item.file}, {"sha1", item.digest ? item.digest->to_hex() : ""}, {"size", item.content.size}};
+    if(!duplicateOf.empty()) {
+        record["duplicateOf"] = duplicateOf;
+        return record;
+    }
+    const auto& result = item.result;
+    const auto& analysis = result.analysis;
+    if(analysis.analysed || analysis.roundTrip != emu::RomAnalysis::eUNKNOWN) {
+        record["variants"] = variantNames(analysis.possibleVariants);
+        record["oddPc"] = analysis.usesOddPcAddress;
+    }
+    if(analysis.analysed) {
+        auto& histogram = record["opcodes"] = nlohmann::json::object();
+        for(const auto& [opcode, count] : analysis.stats) {
+            histogram[fmt::format("{:04X}", opcode)] = count;
+        }
+    }
+    if(!opcodesToFind.empty() || !sequencesToFind.empty())
+        record["found"] = result.foundPatterns;
+    if(!sequencesToFind.empty()) {
+        auto& list = record["sequences"] = nlohmann::json::array();
+        for(const auto& match : result.foundSequences) {
+            list.push_back({{"address", match.address}, {"sequence", sequencesToFind[match.sequence]}, {"opcodes", match.opcodes}});
+        }
+    }
+    if(analysis.roundTrip != emu::RomAnalysis::eUNKNOWN) {
+        record["roundTrip"] = analysis.roundTrip == emu::RomAnalysis::ePASSED ? "passed" : "failed";
+        record["sourceLines"] = result.sourceLines;
+        record["decompile_us"] = result.decompileTime_us;
+        record["assemble_us"] = result.assembleTime_us;
+        record["compare_us"] = result.compareTime_us;
+    }
+    record["errors"] = result.errorMessages;
+    if(result.cached)
+        record["cached"] = true;
+    return record;
+}
+
+nlohmann::json latencyRecord(const ghc::LatencyHistogram& histogram)
+{
+    return {{"p50", histogram.percentile(50)}, {"p90", histogram.percentile(90)}, {"p99", histogram.percentile(99)}, {"max", histogram.max()}};
+}
+
+// Collects the results of all files in input order, writes the per file output and the
+// summary. Normal runs feed it while scanning, --merge with the records of all shards.
+class ScanReport
+{
+public:
+    ScanReport(WorkMode mode, bool scan, bool dumpDoubles, int64_t numSlowest, bool withCache, emu::OpcodeIndexWriter* index, emu::ManifestWriter* manifest)
+        : _mode(mode)
+        , _scan(scan)
+        , _dumpDoubles(dumpDoubles)
+        , _withCache(withCache)
+        , _writer(std::cout)
+        , _slowest(numSlowest > 0 ? size_t(numSlowest) : 0)
+        , _index(index)
+        , _manifest(manifest)
+        // a plain --build-index or --manifest run analyses everything but only reports the summary
+        , _quietFiles((index || manifest) && mode == eANALYSE && !scan)
+    {
+        if(mode == eSHARED_SUBROUTINES)
+            _subroutines = std::make_unique<emu::SubroutineIndex>();
+        if(mode == eCLUSTER)
+            _romClusters = std::make_unique<emu::RomClusters>();
+    }
+
+    void addRejected()
+    {
+        // not a CHIP-8 program according to the deep scan classifier
+        ++_files;
+    }
+
+    void addDouble(const ScanItem& item, const std::string& firstName)
+    {
+        ++_doubles;
+        if(_index)
+            _index->addDuplicate();
+        if(_manifest)
+            _manifest->addDuplicate();
+        if(ndjson)
+            _writer.writeLine(fileRecord(item, firstName).dump());
+        else if(_dumpDoubles)
+            std::clog << "File '" << item.file << "' is identical to '" << firstName << "'" << std::endl;
+    }
+
+    void addFile(const ScanItem& item)
+    {
+        ++_files;
+        auto& result = item.result;
+        if(result.cached)
+            ++_cachedFiles;
+        if(_index)
+            _index->addFile(item.file, item.content.size, result.analysis.possibleVariants, result.analysis.fullStats);
+        if(_manifest && result.analysis.analysed && item.digest) {
+            const auto& analysis = result.analysis;
+            _manifest->addFile(item.file, *item.digest, uint32_t(item.content.size), analysis.startAddress, analysis.possibleVariants, analysis.usesOddPcAddress, analysis.codeBytes, analysis.fullStats);
+        }
+        if(_romClusters && result.signature)
+            _romClusters->add(item.file, *result.signature);
+        if(_subroutines && !result.subroutines.empty()) {
+            auto id = _subroutines->addFile(item.file);
+            for(const auto& fingerprint : result.subroutines) {
+                _subroutines->add(id, fingerprint);
+            }
+        }
+        if(_quietFiles) {
+            std::cerr << result.err.str();
+        }
+        else if(ndjson) {
+            _writer.writeLine(fileRecord(item, {}).dump());
+        }
+        else {
+            std::cerr << result.err.str();
+            std::cout << result.out.str() << std::flush;
+            std::clog << result.log.str();
+        }
+        errors += result.errors;
+        foundFiles += result.foundFiles;
+        totalSourceLines += result.sourceLines;
+        totalDecompileTime_us += result.decompileTime_us;
+        totalAssembleTime_us += result.assembleTime_us;
+        if(result.analysis.roundTrip == emu::RomAnalysis::ePASSED && !result.cached) {
+            decompileLatency.add(result.decompileTime_us);
+            assembleLatency.add(result.assembleTime_us);
+            compareLatency.add(result.compareTime_us);
+            _slowest.add(item.file, result.decompileTime_us, result.assembleTime_us, result.compareTime_us);
+        }
+        for(const auto& [opcode, count] : result.stats) {
+            totalStats[opcode] += count;
+        }
+    }
+
+    int finish(int64_t duration)
+    {
+        std::vector<emu::SubroutineIndex::Cluster> clusters;
+        if(_subroutines)
+            clusters = _subroutines->clusters();
+        std::vector<emu::RomClusters::Cluster> similarRoms;
+        if(_romClusters)
+            similarRoms = _romClusters->clusters();
+        if(ndjson) {
+            nlohmann::json summary = {{"files", _files}, {"duplicates", _doubles}};
+            if(!opcodesToFind.empty() || !sequencesToFind.empty())
+                summary["foundFiles"] = foundFiles;
+            if(_mode == eDEEP_ANALYSE)
+                summary["detected"] = foundFiles;
+            if(roundTrip) {
+                summary["roundTripErrors"] = errors;
+                summary["sourceLines"] = totalSourceLines;
+                summary["decompile_us"] = totalDecompileTime_us;
+                summary["assemble_us"] = totalAssembleTime_us;
+                if(decompileLatency.count()) {
+                    summary["latency_us"] = {{"decompile", latencyRecord(decompileLatency)}, {"assemble", latencyRecord(assembleLatency)}, {"compare", latencyRecord(compareLatency)}};
+                    auto& list = summary["slowest"] = nlohmann::json::array();
+                    for(const auto& entry : _slowest.sorted()) {
+                        list.push_back({{"path", entry.file}, {"total_us", entry.total_us}, {"decompile_us", entry.decompile_us}, {"assemble_us", entry.assemble_us}, {"compare_us", entry.compare_us}});
+                    }
+                }
+            }
+            if(_withCache)
+                summary["cached"] = _cachedFiles;
+            if(_romClusters) {
+                auto& list = summary["clusters"] = nlohmann::json::array();
+                for(const auto& cluster : similarRoms) {
+                    auto members = nlohmann::json::array();
+                    for(const auto& member : cluster) {
+                        members.push_back({{"path", _romClusters->fileName(member.file)}, {"similarity", member.similarity}});
+                    }
+                    list.push_back(members);
+                }
+            }
+            if(_subroutines) {
+                auto& list = summary["sharedSubroutines"] = nlohmann::json::array();
+                for(const auto& cluster : clusters) {
+                    auto variants = nlohmann::json::array();
+                    for(const auto& variant : cluster.variants) {
+                        auto occurrences = nlohmann::json::array();
+                        for(const auto& occurrence : variant.occurrences) {
+                            occurrences.push_back({{"path", _subroutines->fileName(occurrence.file)}, {"address", occurrence.address}});
+                        }
+                        variants.push_back({{"files", variant.numFiles}, {"occurrences", occurrences}});
+                    }
+                    list.push_back({{"length", cluster.length}, {"files", cluster.numFiles}, {"variants", variants}});
+                }
+            }
+            if(_scan) {
+                auto& histogram = summary["opcodes"] = nlohmann::json::object();
+                for(const auto& [opcode, num] : totalStats) {
+                    histogram[fmt::format("{:04X}", opcode)] = num;
+                }
+            }
+            summary["duration_ms"] = duration;
+            _writer.writeLine(nlohmann::json{{"summary", summary}}.dump());
+            _writer.flush();
+            return errors ? 1 : 0;
+        }
+        if(_scan) {
+            std::clog << "Used opcodes:" << std::endl;
+            for(const auto& [opcode, num] : totalStats) {
+                std::clog << fmt::format("{:04X}: {}", opcode, num) << std::endl;
+            }
+        }
+        if(!similarRoms.empty()) {
+            std::cout << "Clusters of similar ROMs:" << std::endl;
+            for(size_t i = 0; i < similarRoms.size(); ++i) {
+                std::cout << fmt::format("    Cluster {}, {} files:", i + 1, similarRoms[i].size()) << std::endl;
+                for(const auto& member : similarRoms[i]) {
+                    std::cout << fmt::format("        {:.2f}  {}", member.similarity, fileOrPath(_romClusters->fileName(member.file))) << std::endl;
+                }
+            }
+        }
+        if(!clusters.empty()) {
+            std::cout << "Shared subroutines:" << std::endl;
+            for(const auto& cluster : clusters) {
+                std::cout << fmt::format("    {} opcodes in {} files, {} variant{}:", cluster.length, cluster.numFiles, cluster.variants.size(), cluster.variants.size() > 1 ? "s" : "") << std::endl;
+                for(const auto& variant : cluster.variants) {
+                    std::string list;
+                    for(size_t i = 0; i < variant.occurrences.size() && i < 5; ++i) {
+                        const auto& occurrence = variant.occurrences[i];
+                        list += fmt::format("{}{}@0x{:04X}", i ? ", " : "", fileOrPath(_subroutines->fileName(occurrence.file)), occurrence.address);
+                    }
+                    if(variant.occurrences.size() > 5)
+                        list += fmt::format(" and {} more", variant.occurrences.size() - 5);
+                    std::cout << fmt::format("        {} file{}: {}", variant.numFiles, variant.numFiles > 1 ? "s" : "", list) << std::endl;
+                }
+            }
+        }
+        std::cerr << std::flush;
+        std::cout << std::flush;
+        if(decompileLatency.count()) {
+            std::clog << "Round trip latency of " << decompileLatency.count() << " passed files:" << std::endl;
+            std::clog << fmt::format("    {:<14}{:>10}{:>10}{:>10}{:>10}", "", "p50", "p90", "p99", "max") << std::endl;
+            for(const auto& [name, histogram] : {std::make_pair("decompile", &decompileLatency), std::make_pair("assemble", &assembleLatency), std::make_pair("sha1 compare", &compareLatency)}) {
+                std::clog << fmt::format("    {:<14}{:>8}us{:>8}us{:>8}us{:>8}us", name, histogram->percentile(50), histogram->percentile(90), histogram->percentile(99), histogram->max()) << std::endl;
+            }
+            auto list = _slowest.sorted();
+            if(!list.empty()) {
+                std::clog << "Slowest ROMs:" << std::endl;
+                for(const auto& entry : list) {
+                    std::clog << fmt::format("    {:>8}us  {} (d:{}us/a:{}us/c:{}us)", entry.total_us, fileOrPath(entry.file), entry.decompile_us, entry.assemble_us, entry.compare_us) << std::endl;
+                }
+            }
+        }
+        std::clog << "Done scanning/decompiling " << _files << " files";
+        if(_doubles)
+            std::clog << ", not counting " << _doubles << " redundant copies";
+        if(foundFiles)
+            std::clog << (_mode == eDEEP_ANALYSE ? ", detected CHIP-8 programs in " : _mode == eFIND_SEQUENCE ? ", found sequences in " : ", found opcodes in ") << foundFiles << " files";
+        if(_subroutines)
+            std::clog << ", found " << clusters.size() << " shared subroutines";
+        if(_romClusters)
+            std::clog << ", found " << similarRoms.size() << " clusters of similar files";
+        if(errors)
+            std::clog << ", round trip errors: " << errors;
+        if(_cachedFiles)
+            std::clog << ", " << _cachedFiles << " answered from scan cache";
+        if(totalSourceLines) {
+            std::clog << ", total number of source lines assembled: " << totalSourceLines;
+            std::clog << ", (d:" << totalDecompileTime_us/1000 << "ms/a:" << totalAssembleTime_us/1000 << "ms)";
+        }
+        std::clog << " (" << duration << "ms)" <<std::endl;
+        return errors ? 1 : 0;
+    }
+
+private:
+    WorkMode _mode;
+    bool _scan;
+    bool _dumpDoubles;
+    bool _withCache;
+    BufferedWriter _writer;
+    SlowestFiles _slowest;
+    emu::OpcodeIndexWriter* _index;
+    emu::ManifestWriter* _manifest;
+    bool _quietFiles;
+    std::unique_ptr<emu::SubroutineIndex> _subroutines;
+    std::unique_ptr<emu::RomClusters> _romClusters;
+    uint64_t _files{0};
+    uint64_t _doubles{0};
+    uint64_t _cachedFiles{0};
+};
+
+// Selects the files of shard index (zero based) out of count by a stable hash of their
+// path relative to the scanned input, so every machine picks the same files.
+struct ShardSpec
+{
+    uint32_t index;
+    uint32_t count;
+    bool contains(const std::string& relativePath) const
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for(auto c : relativePath) {
+            hash = (hash ^ uint8_t(c)) * 0x100000001b3ull;
+        }
+        return hash % count == index;
+    }
+};
+
+// Everything of a scanned file the ScanReport needs, as a partial result record of a
+// shard, and back.
+nlohmann::json partialRecord(const ScanItem& item)
+{
+    nlohmann::json record = {{"index", item.sequence}, {"path", item.file}};
+    if(item.rejected) {
+        record["rejected"] = true;
+        return record;
+    }
+    const auto& result = item.result;
+    const auto& analysis = result.analysis;
+    record["size"] = item.content.size;
+    record["sha1"] = item.digest ? item.digest->to_hex() : "";
+    record["out"] = result.out.str();
+    record["err"] = result.err.str();
+    record["log"] = result.log.str();
+    record["errors"] = result.errors;
+    record["foundFiles"] = result.foundFiles;
+    record["sourceLines"] = result.sourceLines;
+    record["decompile_us"] = result.decompileTime_us;
+    record["assemble_us"] = result.assembleTime_us;
+    record["compare_us"] = result.compareTime_us;
+    auto& stats = record["stats"] = nlohmann::json::object();
+    for(const auto& [opcode, count] : result.stats) {
+        stats[fmt::format("{:04X}", opcode)] = count;
+    }
+    record["found"] = result.foundPatterns;
+    auto& sequences = record["sequences"] = nlohmann::json::array();
+    for(const auto& match : result.foundSequences) {
+        sequences.push_back({match.address, match.sequence, match.opcodes});
+    }
+    record["errorMessages"] = result.errorMessages;
+    record["cached"] = result.cached;
+    record["analysed"] = analysis.analysed;
+    record["variants"] = static_cast<uint64_t>(analysis.possibleVariants);
+    record["oddPc"] = analysis.usesOddPcAddress;
+    auto& opcodes = record["opcodes"] = nlohmann::json::object();
+    for(const auto& [opcode, count] : analysis.stats) {
+        opcodes[fmt::format("{:04X}", opcode)] = count;
+    }
+    record["roundTrip"] = int(analysis.roundTrip);
+    return record;
+}
+
+void loadPartialRecord(const nlohmann::json& record, ScanItem& item)
+{
+    item.sequence = record.at("index").get<size_t>();
+    item.file = record.at("path").get<std::string>();
+    item.rejected = record.value("rejected", false);
+    if(item.rejected)
+        return;
+    auto& result = item.result;
+    auto& analysis = result.analysis;
+    item.content.size = record.at("size").get<uint64_t>();
+    item.digest = Sha1::Digest(record.at("sha1").get<std::string>());
+    result.out.str(record.at("out").get<std::string>());
+    result.err.str(record.at("err").get<std::string>());
+    result.log.str(record.at("log").get<std::string>());
+    result.errors = record.at("errors").get<int>();
+    result.foundFiles = record.at("foundFiles").get<int>();
+    result.sourceLines = record.at("sourceLines").get<int64_t>();
+    result.decompileTime_us = record.at("decompile_us").get<int64_t>();
+    result.assembleTime_us = record.at("assemble_us").get<int64_t>();
+    result.compareTime_us = record.at("compare_us").get<int64_t>();
+    for(const auto& [opcode, count] : record.at("stats").items()) {
+        result.stats[uint16_t(std::stoul(opcode, nullptr, 16))] = count.get<int>();
+    }
+    result.foundPatterns = record.at("found").get<std::vector<std::string>>();
+    for(const auto& match : record.at("sequences")) {
+        result.foundSequences.push_back({match.at(0).get<uint32_t>(), match.at(1).get<uint32_t>(), match.at(2).get<std::string>()});
+    }
+    result.errorMessages = record.at("errorMessages").get<std::vector<std::string>>();
+    result.cached = record.at("cached").get<bool>();
+    analysis.analysed = record.at("analysed").get<bool>();
+    analysis.possibleVariants = static_cast<emu::Chip8Variant>(record.at("variants").get<uint64_t>());
+    analysis.usesOddPcAddress = record.at("oddPc").get<bool>();
+    for(const auto& [opcode, count] : record.at("opcodes").items()) {
+        analysis.stats[uint16_t(std::stoul(opcode, nullptr, 16))] = count.get<int>();
+    }
+    analysis.roundTrip = static_cast<emu::RomAnalysis::RoundTrip>(record.at("roundTrip").get<int>());
+}
+
+// The options that influence the output of a scan, a shard stores them with its partial
+// result and --merge restores them.
+nlohmann::json outputOptions(WorkMode mode, bool scan, bool dumpDoubles, int64_t numSlowest, bool withCache)
+{
+    return {{"mode", int(mode)}, {"scan", scan}, {"listDuplicates", dumpDoubles}, {"slowest", numSlowest}, {"cache", withCache}, {"find", opcodesToFind}, {"findSeq", sequencesToFind},
+            {"opcodeUse", withUsage}, {"fullPath", fullPath}, {"roundTrip", roundTrip}, {"ndjson", ndjson}};
+}
+
+int disassembleOrAnalyze(bool scan, bool dumpDoubles, std::vector<std::string>& inputList, WorkMode& mode, int64_t jobs, int64_t numSlowest, emu::ScanCache* cache, emu::OpcodeIndexWriter* index, emu::ManifestWriter* manifest, const ShardSpec* shard)
 {
     auto start= std::chrono::steady_clock::now();
-    uint64_t files = 0;
-    uint64_t doubles = 0;
+    ghc::WorkStealingPool pool(jobs > 1 ? jobs : 0);
+    ScanReport report(mode, scan, dumpDoubles, numSlowest, cache != nullptr, index, manifest);
+    nlohmann::json partialFiles = nlohmann::json::array();
+    FirstSeenIndex firstSeen;
+    DuplicateIndex duplicates([](const std::string& file) {
+        emu::MappedFile data(file);
+        CHIPLET_TRACE_SPAN("sha1", file);
+        return calculateSha1(data.data(), data.size());
+    });
+    // the ndjson output, the cache, a manifest and a shard need the SHA-1 of every file,
+    // otherwise it is only calculated for files that share size and fast hash with another one
+    bool needDigest = ndjson || cache || manifest || shard;
+    std::deque<std::unique_ptr<ScanItem>> pending;
+    size_t numSubmitted = 0;
+    size_t numEnumerated = 0;
+    auto emit = [&](ScanItem& item) {
+        item.done.get();
+        if(item.rejected) {
+            if(shard)
+                partialFiles.push_back(partialRecord(item));
+            else
+                report.addRejected();
+            return;
+        }
+        auto firstFile = duplicates.checkDouble(item.file, item.content, item.digest);
+        bool isDouble = firstFile.has_value();
+        auto firstName = firstFile.value_or("");
+        if(!isDouble && item.skipped) {
+            // a fast hash collision of different content, this needs its own work after all
+            if(item.archive)
+                workFile(mode, item.file, item.archiveData, item.result);
+            else
+                workFile(mode, item.file, emu::MappedFile(item.file), item.result);
+        }
+        if(cache && item.fileKey && item.digest && !item.result.cached) {
+            cache->update(fs::absolute(item.file).string(), {*item.fileKey, item.content.hash, *item.digest}, isDouble ? emu::RomAnalysis{} : item.result.analysis);
+        }
+        if(shard)
+            partialFiles.push_back(partialRecord(item));
+        else if(isDouble)
+            report.addDouble(item, firstName);
+        else
+            report.addFile(item);
+    };
+    // items are emitted in submission order, so a slow file at the front holds the results
+    // of everything after it, waiting for it once that backlog reaches a few items per
+    // thread bounds the memory while the workers still have enough to do
+    const size_t maxPending = std::max<size_t>(pool.size(), 1) * 8;
+    auto emitReady = [&](size_t keepPending) {
+        while(!pending.empty() && (pending.size() > keepPending || pending.front()->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+            emit(*pending.front());
+            pending.pop_front();
+        }
+    };
+    auto submit = [&](const std::string& file, const std::string& relativePath, std::shared_ptr<emu::MappedFile> archive = {}, emu::ByteView archiveData = {}) {
+        auto sequence = numEnumerated++;
+        if(shard && !shard->contains(relativePath))
+            return;
+        auto item = std::make_unique<ScanItem>();
+        item->file = file;
+        item->sequence = sequence;
+        item->archive = std::move(archive);
+        item->archiveData = archiveData;
+        auto index = numSubmitted++;
+        auto* itemPtr = item.get();
+        item->done = pool.submit([itemPtr, index, mode, needDigest, &firstSeen, cache]() {
+            if(cache && mode != eDEEP_ANALYSE && !itemPtr->archive && (itemPtr->fileKey = emu::ScanCache::fileKey(itemPtr->file))) {
+                // an unchanged file doesn't need to be read at all if the analysis is known
+                if(auto* entry = cache->lookupFile(fs::absolute(itemPtr->file).string(), *itemPtr->fileKey)) {
+                    itemPtr->content = {entry->key.size, entry->hash};
+                    itemPtr->digest = entry->digest;
+                    if(!firstSeen.claim(itemPtr->content, index)) {
+                        itemPtr->skipped = true;
+                        return;
+                    }
+                    auto* analysis = cache->lookupAnalysis(entry->digest, romStartAddress(itemPtr->file));
+                    if(analysis && reportCached(mode, itemPtr->file, *analysis, itemPtr->result)) {
+                        itemPtr->result.analysis = *analysis;
+                        itemPtr->result.cached = true;
+                        return;
+                    }
+                    workFile(mode, itemPtr->file, emu::MappedFile(itemPtr->file), itemPtr->result);
+                    return;
+                }
+            }
+            emu::MappedFile file;
+            emu::ByteView data = itemPtr->archiveData;
+            if(!itemPtr->archive) {
+                CHIPLET_TRACE_SPAN("file load", itemPtr->file);
+                file = emu::MappedFile(itemPtr->file);
+                data = file;
+            }
+            if(mode == eDEEP_ANALYSE && !emu::Chip8Classifier::classify(data, romStartAddress(itemPtr->file)).candidate) {
+                itemPtr->rejected = true;
+                return;
+            }
+            itemPtr->content = {data.size(), fastHash64(data.data(), data.size())};
+            bool first = firstSeen.claim(itemPtr->content, index);
+            // archive entries can't be loaded again by name, so they always get their SHA-1
+            if(needDigest || !first || itemPtr->archive) {
+                CHIPLET_TRACE_SPAN("sha1", itemPtr->file);
+                itemPtr->digest = calculateSha1(data.data(), data.size());
+            }
+            if(first)
+                workFile(mode, itemPtr->file, data, itemPtr->result);
+            else
+                itemPtr->skipped = true;
+        });
+        pending.push_back(std::move(item));
+        emitReady(maxPending);
+    };
+    auto submitArchive = [&](const std::string& file, const std::string& relativePath) {
+        // entries are reported as "archive.tar!inner/path.ch8" and point into the mapped archive
+        auto archive = std::make_shared<emu::MappedFile>(file, std::numeric_limits<size_t>::max());
+        emu::TarReader reader(*archive);
+        emu::TarReader::Entry entry;
+        while(reader.next(entry)) {
+            if(mode == eDEEP_ANALYSE || isChipRom(fs::path(entry.name).extension().string()))
+                submit(file + "!" + entry.name, relativePath + "!" + entry.name, archive, entry.data);
+        }
+        if(reader.error() || archive->empty())
+            std::cerr << "ERROR: Couldn't read tar archive '" << file << "'" << std::endl;
+    };
     for(const auto& input : inputList) {
         if(!fs::exists(input)) {
             std::cerr << "Couldn't find input file: " << input << std::endl;
@@ -224,57 +1147,311 @@ int disassembleOrAnalyze(bool scan, bool dumpDoubles, std::vector<std::string>&
         }
         if(fs::is_directory(input)) {
             for(const auto& de : fs::recursive_directory_iterator(input, fs::directory_options::skip_permission_denied)) {
-                if(de.is_regular_file() && isChipRom(de.path().extension().string())) {
-                    auto file = loadFile(de.path().string());
-                    auto [isDouble, firstName] = checkDouble(de.path().string(), file);
-                    if(isDouble) {
-                        ++doubles;
-                        if(dumpDoubles)
-                            std::clog << "File '" << de.path().string() << "' is identical to '" << firstName << "'" << std::endl;
-                    }
-                    else {
-                        ++files;
-                        workFile(mode, de.path().string(), file);
-                    }
+                if(de.is_regular_file() && isTarArchive(de.path().extension().string())) {
+                    submitArchive(de.path().string(), de.path().lexically_relative(input).generic_string());
+                }
+                else if(de.is_regular_file() && (mode == eDEEP_ANALYSE || isChipRom(de.path().extension().string()))) {
+                    submit(de.path().string(), de.path().lexically_relative(input).generic_string());
+                }
+            }
+        }
+        else if(fs::is_regular_file(input) && isTarArchive(fs::path(input).extension().string())) {
+            submitArchive(input, fs::path(input).filename().string());
+        }
+        else if(fs::is_regular_file(input) && (mode == eDEEP_ANALYSE || isChipRom(fs::path(input).extension().string()))) {
+            submit(input, fs::path(input).filename().string());
+        }
+    }
+    emitReady(0);
+    auto duration= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if(shard) {
+        nlohmann::json partial = {{"generator", "chiplet v" CHIPLET_VERSION " [" CHIPLET_HASH "]"}, {"shard", {shard->index + 1, shard->count}}, {"enumerated", numEnumerated},
+                                  {"options", outputOptions(mode, scan, dumpDoubles, numSlowest, cache != nullptr)}, {"duration_ms", duration}, {"files", std::move(partialFiles)}};
+        std::cout << partial.dump() << std::endl;
+        return errors ? 1 : 0;
+    }
+    return report.finish(duration);
+}
+
+// The options of a sharded run that only influence the report.
+struct ReportOptions
+{
+    WorkMode mode{eANALYSE};
+    bool scan{false};
+    bool dumpDoubles{false};
+    int64_t numSlowest{0};
+    bool withCache{false};
+};
+
+// A partial result written by a --shard run.
+struct PartialResult
+{
+    uint32_t shard{};
+    uint32_t numShards{};
+    uint64_t enumerated{};
+    nlohmann::json options;
+    int64_t duration{};
+    std::vector<std::unique_ptr<ScanItem>> items;
+};
+
+bool loadPartialResult(const std::string& file, PartialResult& partial)
+{
+    try {
+        std::ifstream is(file);
+        auto json = nlohmann::json::parse(is);
+        if(json.at("generator").get<std::string>() != "chiplet v" CHIPLET_VERSION " [" CHIPLET_HASH "]") {
+            std::cerr << "ERROR: Partial result '" << file << "' was written by a different chiplet version" << std::endl;
+            return false;
+        }
+        partial.shard = json.at("shard").at(0).get<uint32_t>();
+        partial.numShards = json.at("shard").at(1).get<uint32_t>();
+        partial.enumerated = json.at("enumerated").get<uint64_t>();
+        partial.options = json.at("options");
+        partial.duration = json.at("duration_ms").get<int64_t>();
+        for(const auto& record : json.at("files")) {
+            partial.items.push_back(std::make_unique<ScanItem>());
+            loadPartialRecord(record, *partial.items.back());
+        }
+        return true;
+    }
+    catch(std::exception& ex) {
+        std::cerr << "ERROR: Couldn't read partial result '" << file << "': " << ex.what() << std::endl;
+        return false;
+    }
+}
+
+// Loads the partial results of all shards of a run and restores the output options they
+// were written with, so the merged report is the same as the one of a single run.
+bool loadPartialResults(const std::vector<std::string>& inputList, std::vector<PartialResult>& partials, ReportOptions& reportOptions)
+{
+    partials.resize(inputList.size());
+    for(size_t i = 0; i < inputList.size(); ++i) {
+        if(!loadPartialResult(inputList[i], partials[i]))
+            return false;
+    }
+    std::vector<bool> seen;
+    for(const auto& partial : partials) {
+        if(partial.numShards != partials.front().numShards || partial.options != partials.front().options || partial.enumerated != partials.front().enumerated) {
+            std::cerr << "ERROR: The partial results are not from shards of the same run" << std::endl;
+            return false;
+        }
+        seen.resize(partial.numShards, false);
+        if(!partial.shard || partial.shard > partial.numShards || seen[partial.shard - 1]) {
+            std::cerr << "ERROR: Shard " << partial.shard << "/" << partial.numShards << " given more than once" << std::endl;
+            return false;
+        }
+        seen[partial.shard - 1] = true;
+    }
+    if(partials.empty() || std::find(seen.begin(), seen.end(), false) != seen.end()) {
+        std::cerr << "ERROR: Missing shards, all " << (partials.empty() ? 0 : partials.front().numShards) << " partial results are needed to merge" << std::endl;
+        return false;
+    }
+    const auto& options = partials.front().options;
+    reportOptions.mode = static_cast<WorkMode>(options.at("mode").get<int>());
+    reportOptions.scan = options.at("scan").get<bool>();
+    reportOptions.dumpDoubles = options.at("listDuplicates").get<bool>();
+    reportOptions.numSlowest = options.at("slowest").get<int64_t>();
+    reportOptions.withCache = options.at("cache").get<bool>();
+    opcodesToFind = options.at("find").get<std::vector<std::string>>();
+    sequencesToFind = options.at("findSeq").get<std::vector<std::string>>();
+    withUsage = options.at("opcodeUse").get<bool>();
+    fullPath = options.at("fullPath").get<bool>();
+    roundTrip = options.at("roundTrip").get<bool>();
+    ndjson = options.at("ndjson").get<bool>();
+    return true;
+}
+
+// Replays the files of all shards in the order a single run would have seen them, the
+// first copy of each content is the one reported, all others are duplicates.
+int mergePartialResults(std::vector<PartialResult>& partials, const ReportOptions& options)
+{
+    std::vector<ScanItem*> items;
+    int64_t duration = 0;
+    for(auto& partial : partials) {
+        for(auto& item : partial.items) {
+            items.push_back(item.get());
+        }
+        duration = std::max(duration, partial.duration);
+    }
+    std::sort(items.begin(), items.end(), [](const ScanItem* a, const ScanItem* b) { return a->sequence < b->sequence; });
+    ScanReport report(options.mode, options.scan, options.dumpDoubles, options.numSlowest, options.withCache, nullptr, nullptr);
+    std::unordered_map<Sha1::Digest, std::string> firstFiles;
+    for(auto* item : items) {
+        if(item->rejected) {
+            report.addRejected();
+            continue;
+        }
+        auto [iter, isFirst] = firstFiles.emplace(*item->digest, item->file);
+        if(isFirst)
+            report.addFile(*item);
+        else
+            report.addDouble(*item, iter->second);
+    }
+    return report.finish(duration);
+}
+
+// Loads indexed files again for -u, entries of tar archives ("archive.tar!inner/path.ch8")
+// are looked up in the archive, that is only mapped and walked once.
+class IndexedFileLoader
+{
+public:
+    emu::ByteView load(const std::string& file)
+    {
+        std::error_code ec;
+        if(fs::is_regular_file(file, ec)) {
+            _file = emu::MappedFile(file);
+            return _file;
+        }
+        for(auto pos = file.find('!'); pos != std::string::npos; pos = file.find('!', pos + 1)) {
+            auto archiveFile = file.substr(0, pos);
+            if(!isTarArchive(fs::path(archiveFile).extension().string()) || !fs::is_regular_file(archiveFile, ec))
+                continue;
+            auto iter = _archives.find(archiveFile);
+            if(iter == _archives.end()) {
+                iter = _archives.emplace(archiveFile, Archive{}).first;
+                iter->second.data = emu::MappedFile(archiveFile, std::numeric_limits<size_t>::max());
+                emu::TarReader reader(iter->second.data);
+                emu::TarReader::Entry entry;
+                while(reader.next(entry)) {
+                    iter->second.entries.emplace(entry.name, entry.data);
                 }
             }
+            auto entry = iter->second.entries.find(file.substr(pos + 1));
+            if(entry != iter->second.entries.end())
+                return entry->second;
+        }
+        return {};
+    }
+
+private:
+    struct Archive
+    {
+        emu::MappedFile data;
+        std::unordered_map<std::string, emu::ByteView> entries;
+    };
+    emu::MappedFile _file;
+    std::map<std::string, Archive> _archives;
+};
+
+// Answers -f from an opcode index instead of decompiling every file, with -u only the
+// hits are loaded and decompiled again.
+int findInIndex(const std::string& indexFile)
+{
+    auto start= std::chrono::steady_clock::now();
+    emu::OpcodeIndex index;
+    if(!index.open(indexFile)) {
+        std::cerr << "ERROR: Couldn't read opcode index '" << indexFile << "'" << std::endl;
+        return 1;
+    }
+    auto numFiles = index.numFiles();
+    std::vector<std::vector<bool>> hits(opcodesToFind.size(), std::vector<bool>(numFiles, false));
+    for(uint32_t opcode = 0; opcode <= 0xFFFF; ++opcode) {
+        for(auto pattern : findMatcher.patterns(uint16_t(opcode))) {
+            for(const auto& posting : index.postings(uint16_t(opcode))) {
+                hits[pattern][posting.file] = true;
+            }
+        }
+    }
+    BufferedWriter writer(std::cout);
+    IndexedFileLoader loader;
+    for(uint32_t file = 0; file < numFiles; ++file) {
+        std::vector<std::string> found;
+        for(size_t i = 0; i < opcodesToFind.size(); ++i) {
+            if(hits[i][file])
+                found.push_back(opcodesToFind[i]);
         }
-        else if(fs::is_regular_file(input) && isChipRom(fs::path(input).extension().string())) {
-            auto file = loadFile(input);
-            auto [isDouble, firstName] = checkDouble(input, file);
-            if(isDouble) {
-                ++doubles;
-                if(dumpDoubles)
-                    std::clog << "File '" << input << "' is identical to '" << firstName << "'" << std::endl;
+        if(found.empty())
+            continue;
+        std::string name(index.fileName(file));
+        if(withUsage) {
+            WorkResult result;
+            auto data = loader.load(name);
+            if(data.empty()) {
+                std::cerr << "ERROR: Couldn't load indexed file '" << name << "'" << std::endl;
+                continue;
+            }
+            workFile(eSEARCH, name, data, result);
+            foundFiles += result.foundFiles;
+            if(ndjson) {
+                writer.writeLine(nlohmann::json{{"path", name}, {"size", index.fileSize(file)}, {"variants", variantNames(index.variants(file))}, {"found", result.foundPatterns}}.dump());
             }
             else {
-                ++files;
-                workFile(mode, input, file);
+                std::cerr << result.err.str();
+                std::cout << result.out.str() << std::flush;
             }
+            continue;
         }
-    }
-    if(scan) {
-        std::clog << "Used opcodes:" << std::endl;
-        for(const auto& [opcode, num] : emu::Chip8Decompiler::totalStats()) {
-            std::clog << fmt::format("{:04X}: {}", opcode, num) << std::endl;
+        ++foundFiles;
+        if(ndjson) {
+            writer.writeLine(nlohmann::json{{"path", name}, {"size", index.fileSize(file)}, {"variants", variantNames(index.variants(file))}, {"found", found}}.dump());
+        }
+        else {
+            std::string line;
+            for(const auto& pattern : found) {
+                line += (line.empty() ? "" : ", ") + pattern;
+            }
+            writer.writeLine(line + ": " + fileOrPath(name));
         }
     }
     auto duration= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
-    std::cerr << std::flush;
-    std::cout << std::flush;
-    std::clog << "Done scanning/decompiling " << files << " files";
-    if(doubles)
-        std::clog << ", not counting " << doubles << " redundant copies";
+    if(ndjson) {
+        nlohmann::json summary = {{"files", numFiles}, {"duplicates", index.numDuplicates()}, {"foundFiles", foundFiles}, {"duration_ms", duration}};
+        writer.writeLine(nlohmann::json{{"summary", summary}}.dump());
+        writer.flush();
+        return 0;
+    }
+    writer.flush();
+    std::clog << "Done scanning/decompiling " << numFiles << " files";
+    if(index.numDuplicates())
+        std::clog << ", not counting " << index.numDuplicates() << " redundant copies";
     if(foundFiles)
         std::clog << ", found opcodes in " << foundFiles << " files";
-    if(errors)
-        std::clog << ", round trip errors: " << errors;
-    if(totalSourceLines) {
-        std::clog << ", total number of source lines assembled: " << totalSourceLines;
-        std::clog << ", (d:" << totalDecompileTime_us/1000 << "ms/a:" << totalAssembleTime_us/1000 << "ms)";
-    }
     std::clog << " (" << duration << "ms)" <<std::endl;
-    return errors ? 1 : 0;
+    return 0;
+}
+
+// Answers a --query from the columns of a manifest, without loading or decompiling any ROM.
+int queryManifest(const std::string& manifestFile, const std::string& expression)
+{
+    auto start= std::chrono::steady_clock::now();
+    emu::ManifestQuery query;
+    if(!query.parse(expression)) {
+        std::cerr << "ERROR: Invalid query: " << query.error() << std::endl;
+        return 1;
+    }
+    emu::Manifest manifest;
+    if(!manifest.open(manifestFile)) {
+        std::cerr << "ERROR: Couldn't read manifest '" << manifestFile << "'" << std::endl;
+        return 1;
+    }
+    auto rows = query.select(manifest);
+    BufferedWriter writer(std::cout);
+    for(auto row : rows) {
+        std::string name(manifest.fileName(row));
+        if(ndjson) {
+            auto size = manifest.sizes()[row];
+            auto codeBytes = manifest.codeBytes()[row];
+            writer.writeLine(nlohmann::json{{"path", name}, {"sha1", manifest.digest(row).to_hex()}, {"size", size}, {"start", manifest.startAddresses()[row]},
+                                            {"variants", variantNames(static_cast<emu::Chip8Variant>(manifest.variants()[row]))}, {"oddPc", manifest.oddPc()[row] != 0},
+                                            {"codeBytes", codeBytes}, {"dataBytes", size - std::min(size, codeBytes)}, {"opcodes", manifest.opcodes(row).size()}}.dump());
+        }
+        else {
+            writer.writeLine(fileOrPath(name));
+        }
+    }
+    auto duration= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if(ndjson) {
+        nlohmann::json summary = {{"files", manifest.numRows()}, {"duplicates", manifest.numDuplicates()}, {"foundFiles", rows.size()}, {"duration_ms", duration}};
+        writer.writeLine(nlohmann::json{{"summary", summary}}.dump());
+        writer.flush();
+        return 0;
+    }
+    writer.flush();
+    std::clog << "Done querying " << manifest.numRows() << " files";
+    if(manifest.numDuplicates())
+        std::clog << ", not counting " << manifest.numDuplicates() << " redundant copies";
+    std::clog << ", " << rows.size() << " files matching (" << duration << "ms)" << std::endl;
+    return 0;
 }
 
 int main(int argc, char* argv[])
@@ -291,6 +1468,12 @@ int main(int argc, char* argv[])
     bool scan = false;
     bool deepscan = false;
     bool dumpDoubles = false;
+    bool sharedSubroutines = false;
+    bool cluster = false;
+    bool merge = false;
+    bool serve = false;
+    bool watch = false;
+    bool writeDepFile = false;
     bool cartridgeBuild = false;
     std::string cartridgeLabel;
     std::string cartridgeImage;
@@ -299,6 +1482,19 @@ int main(int argc, char* argv[])
     int verbosity = 1;
     int rc = 0;
     int64_t startAddress = 0x200;
+    int64_t jobs = 1;
+    int64_t numSlowest = 10;
+    std::string scanCacheFile;
+    std::string buildIndexFile;
+    std::string indexFile;
+    std::string manifestFile;
+    std::string query;
+    std::string shardOption;
+    std::string socketPath;
+    std::string depFile;
+    std::string buildManifestFile;
+    std::string traceFile;
+    std::string outputFormat = "text";
     std::vector<std::string> includePaths;
     std::vector<std::string> inputList;
     std::vector<std::string> defineList;
@@ -313,35 +1509,78 @@ int main(int argc, char* argv[])
     cli.option({"--cartridge-image"}, cartridgeImage, "generate an Octo compatible cartridge gif with the given image as label");
     cli.option({"--cartridge-options"}, cartridgeOptions, "specifies a JSON file that contains the options to use for the cartridge");
     cli.option({"--cartridge-variant"}, cartridgeVariant, "specifies a CHIP-8 variant that will be used to set the options (chip-8, schip, octo, xo-chip)");
+    cli.option({"-MD"}, writeDepFile, "write a Makefile style dependency file of all used source files and images, named like the output with .d extension");
+    cli.option({"-MF"}, depFile, "name of the dependency file to write, implies -MD");
+    cli.option({"--build-manifest"}, buildManifestFile, "build all targets described in the given JSON file concurrently (see -j), sharing loaded include files and images");
+    cli.option({"--watch"}, watch, "keep running and rebuild the output whenever one of the used source files or images changes");
 
     cli.category("Disassembler/Analyzer");
     cli.option({"-d", "--disassemble"}, disassemble, "disassemble a given file");
     cli.option({"-s", "--scan"}, scan, "scan files or directories for chip roms and analyze them, giving some information");
     cli.option({"--deep-scan"}, deepscan, "scan a directory tree for any files that look like CHIP-8 variant programs and list them, ignoring extensions");
     cli.option({"-f", "--find"}, opcodesToFind, "search for use of opcodes");
+    cli.option({"--find-seq"}, sequencesToFind, "search for sequences of opcodes in the code, e.g. \"F?29 D??5\"");
+    cli.option({"--shared-subs"}, sharedSubroutines, "find subroutines that are shared between the scanned files, ignoring their location");
+    cli.option({"--cluster"}, cluster, "group the scanned files into clusters of similar programs, like hacked or padded variants");
     cli.option({"-u", "--opcode-use"}, withUsage, "show usage of found opcodes when using -f");
     cli.option({"-p", "--full-path"}, fullPath, "print file names with path");
     cli.option({"--list-duplicates"}, dumpDoubles, "show found duplicates while scanning directories");
     cli.option({"--round-trip"}, roundTrip, "decompile and assemble and compare the result");
+    cli.option({"--mismatch-dir"}, mismatchDir, "write source and binary of failed round trips into the given directory");
+    cli.option({"--slowest"}, numSlowest, "number of slowest ROMs to list after a round trip, default is 10");
     cli.option({"-l", "--listing"}, genListing, "generate additional listing with addresses");
+    cli.option({"-j", "--jobs"}, jobs, "number of files to scan/decompile in parallel, 0 uses all cores, default is 1");
+    cli.option({"--format"}, outputFormat, "output format of scan, find and round-trip results, text (default) or ndjson");
+    cli.option({"--scan-cache"}, scanCacheFile, "keep analysis results in the given cache file (e.g. .chiplet-scan-cache) to skip unchanged files on the next run");
+    cli.option({"--build-index"}, buildIndexFile, "write an opcode index of all analysed files to the given file, alone or together with -s/-f");
+    cli.option({"--index"}, indexFile, "answer -f from the given opcode index instead of scanning files");
+    cli.option({"--manifest"}, manifestFile, "write a columnar manifest of all analysed files to the given file, alone or together with -s/-f, or read it for --query");
+    cli.option({"--query"}, query, "list the files of the manifest given with --manifest that match an expression, e.g. \"variants & XO_CHIP && uses(F002)\"");
+    cli.option({"--shard"}, shardOption, "only work on shard i of n (e.g. 2/4) of the files, selected by path, and write a partial result to stdout");
+    cli.option({"--merge"}, merge, "merge the partial results of all shards given as input files into one report");
+
+    cli.category("Compile Server");
+    cli.option({"--serve"}, serve, "run as compile server, answering JSON requests (one per line) from stdin or the --socket");
+    cli.option({"--socket"}, socketPath, "unix domain socket the compile server listens on instead of stdin/stdout");
 
     cli.category("General");
     cli.option({"-q", "--quiet"}, quiet, "suppress all output during operation");
     cli.option({"-v", "--verbose"}, verbose, "more verbose progress output");
     cli.option({"--version"}, version, "just shows version info and exits");
+    cli.option({"--trace"}, traceFile, "record the time spent in loading, preprocessing, assembling, decompiling and output into the given Chrome trace-event file");
 
     cli.positional(inputList, "Files or directories to work on");
     cli.parse();
 
-    auto& logstream = preprocess && outputFile.empty() ? std::clog : std::cout;
+    if(outputFormat == "ndjson") {
+        ndjson = true;
+    }
+    else if(outputFormat != "text") {
+        std::cerr << "ERROR: Unknown output format '" << outputFormat << "', use text or ndjson." << std::endl;
+        exit(1);
+    }
+
+    std::optional<ShardSpec> shard;
+    if(!shardOption.empty()) {
+        unsigned index = 0, count = 0;
+        char separator = 0;
+        std::istringstream is(shardOption);
+        if(!(is >> index >> separator >> count) || separator != '/' || !is.eof() || !index || index > count) {
+            std::cerr << "ERROR: Invalid shard '" << shardOption << "', expected i/n with 1 <= i <= n." << std::endl;
+            exit(1);
+        }
+        shard = ShardSpec{index - 1, count};
+    }
 
     WorkMode mode = eCOMPILE;
-    int modes = 0;
-    if(!opcodesToFind.empty() || scan) {
-        mode = scan ? eANALYSE : eSEARCH;
+    int modes = merge || !query.empty() || serve || !buildManifestFile.empty() ? 1 : 0;
+    if(!opcodesToFind.empty() || !sequencesToFind.empty() || scan || sharedSubroutines || cluster || !buildIndexFile.empty() || (!manifestFile.empty() && query.empty())) {
+        mode = scan ? eANALYSE : !opcodesToFind.empty() ? eSEARCH : !sequencesToFind.empty() ? eFIND_SEQUENCE : sharedSubroutines ? eSHARED_SUBROUTINES : cluster ? eCLUSTER : eANALYSE;
         if(deepscan)
             mode = eDEEP_ANALYSE;
         modes++;
+        if(int(!opcodesToFind.empty()) + int(!sequencesToFind.empty()) + int(sharedSubroutines) + int(cluster) > 1)
+            modes++;
     }
     if(disassemble) {
         mode = eDISASSEMBLE;
@@ -362,6 +1601,60 @@ int main(int argc, char* argv[])
         std::cerr << "ERROR: Multiple operation modes selected!" << std::endl;
         exit(1);
     }
+    if(!indexFile.empty() && (mode != eSEARCH || !buildIndexFile.empty())) {
+        std::cerr << "ERROR: An opcode index can only be used with --find!" << std::endl;
+        exit(1);
+    }
+    if(!socketPath.empty() && !serve) {
+        std::cerr << "ERROR: A socket can only be used with --serve!" << std::endl;
+        exit(1);
+    }
+    if(watch && ((mode != eCOMPILE && mode != ePREPROCESS) || modes != (mode == ePREPROCESS ? 1 : 0) || outputFile.empty())) {
+        std::cerr << "ERROR: Watching is only supported for assembling or preprocessing into an output file (use -o/--output)!" << std::endl;
+        exit(1);
+    }
+    if((writeDepFile || !depFile.empty()) && ((mode != eCOMPILE && mode != ePREPROCESS) || modes != (mode == ePREPROCESS ? 1 : 0) || outputFile.empty())) {
+        std::cerr << "ERROR: A dependency file can only be written when assembling or preprocessing into an output file (use -o/--output)!" << std::endl;
+        exit(1);
+    }
+    if(writeDepFile && depFile.empty()) {
+        depFile = fs::path(outputFile).replace_extension(".d").string();
+    }
+    if(!buildManifestFile.empty() && (!inputList.empty() || !outputFile.empty() || watch || writeDepFile || !depFile.empty())) {
+        std::cerr << "ERROR: A build manifest describes inputs and outputs itself, it can't be combined with input files, -o, -MD/-MF or --watch!" << std::endl;
+        exit(1);
+    }
+    if(!traceFile.empty() && (watch || serve)) {
+        std::cerr << "ERROR: A trace can't be recorded with --watch or --serve!" << std::endl;
+        exit(1);
+    }
+#if !defined(CHIPLET_WITH_TRACE)
+    if(!traceFile.empty()) {
+        std::cerr << "ERROR: This build of chiplet has no trace support (configure with -DCHIPLET_WITH_TRACE=ON)!" << std::endl;
+        exit(1);
+    }
+#endif
+    if(!query.empty() && (manifestFile.empty() || !inputList.empty())) {
+        std::cerr << "ERROR: A query needs a manifest given with --manifest and no input files!" << std::endl;
+        exit(1);
+    }
+    if(shard && ((mode != eANALYSE && mode != eSEARCH && mode != eFIND_SEQUENCE && mode != eDEEP_ANALYSE && !(mode == eDISASSEMBLE && roundTrip)) || !buildIndexFile.empty() || !manifestFile.empty())) {
+        std::cerr << "ERROR: Sharding is only supported for --scan, --find, --find-seq, --deep-scan and --round-trip!" << std::endl;
+        exit(1);
+    }
+    if(ndjson && query.empty() && mode != eANALYSE && mode != eSEARCH && mode != eFIND_SEQUENCE && mode != eSHARED_SUBROUTINES && mode != eCLUSTER && mode != eDEEP_ANALYSE && !(mode == eDISASSEMBLE && roundTrip)) {
+        std::cerr << "ERROR: The ndjson format is only supported for --scan, --find and --round-trip!" << std::endl;
+        exit(1);
+    }
+
+    // a merge restores the output options of the sharded run, so they are only known now
+    std::vector<PartialResult> partials;
+    ReportOptions mergeOptions;
+    if(merge && !loadPartialResults(inputList, partials, mergeOptions)) {
+        exit(1);
+    }
+
+    auto& logstream = (preprocess && outputFile.empty()) || ndjson || shard || serve ? std::clog : std::cout;
 
     if(quiet)
         verbosity = 0;
@@ -385,31 +1678,78 @@ int main(int argc, char* argv[])
             logstream << "INFO: Current directory: " << fs::current_path().string() << std::endl;
     }
 
+#if defined(CHIPLET_WITH_TRACE)
+    ghc::TraceRecording traceRecording(traceFile);
+#endif
+    compileFindPatterns();
+    if(auto error = compileFindSequences(); !error.empty()) {
+        std::cerr << "ERROR: " << error << std::endl;
+        exit(1);
+    }
+    if(!indexFile.empty()) {
+        return findInIndex(indexFile);
+    }
+    if(merge) {
+        return mergePartialResults(partials, mergeOptions);
+    }
+    if(!query.empty()) {
+        return queryManifest(manifestFile, query);
+    }
+    if(!buildManifestFile.empty()) {
+        emu::MultiBuild builds(includePaths, defineList);
+        if(!builds.load(buildManifestFile)) {
+            std::cerr << "ERROR: " << builds.error() << std::endl;
+            return 1;
+        }
+        if(jobs <= 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        return builds.build(size_t(jobs), logstream, quiet);
+    }
+    if(serve) {
+        emu::CompileServer server(includePaths, defineList);
+        return socketPath.empty() ? server.serve(std::cin, std::cout) : server.serveSocket(socketPath);
+    }
+
     if(inputList.empty()) {
         std::cerr << "ERROR: No input files given" << std::endl;
         exit(1);
     }
 
-    if(mode == eANALYSE || mode == eDISASSEMBLE || mode == eSEARCH || mode == eDEEP_ANALYSE)
-        rc = disassembleOrAnalyze(scan, dumpDoubles, inputList, mode);
-    else {
-        emu::OctoCompiler compiler;
-        compiler.setStartAddress(startAddress);
-        compiler.generateLineInfos(!noLineInfo);
-        compiler.setIncludePaths(includePaths);
-        if(!quiet) {
-            compiler.setProgressHandler([&](int verbLvl, std::string msg) {
-                if (verbLvl <= verbosity) {
-                    logstream << std::string(verbLvl * 2 - 2, ' ') << msg << std::endl;
-                }
-            });
+    if(mode == eANALYSE || mode == eDISASSEMBLE || mode == eSEARCH || mode == eFIND_SEQUENCE || mode == eSHARED_SUBROUTINES || mode == eCLUSTER || mode == eDEEP_ANALYSE) {
+        if(jobs <= 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        std::unique_ptr<emu::ScanCache> cache;
+        if(!scanCacheFile.empty()) {
+            cache = std::make_unique<emu::ScanCache>(scanCacheFile, "chiplet v" CHIPLET_VERSION " [" CHIPLET_HASH "]");
+            cache->load();
         }
-
-        auto start = steady_clock::now();
-        for(const auto& def : defineList) {
-            compiler.define(def, 1);
+        if(!mismatchDir.empty()) {
+            std::error_code ec;
+            fs::create_directories(mismatchDir, ec);
+            if(ec) {
+                std::cerr << "ERROR: Couldn't create mismatch directory '" << mismatchDir << "'" << std::endl;
+                exit(1);
+            }
         }
-        emu::CompileResult result;
+        std::unique_ptr<emu::OpcodeIndexWriter> index;
+        if(!buildIndexFile.empty())
+            index = std::make_unique<emu::OpcodeIndexWriter>();
+        std::unique_ptr<emu::ManifestWriter> manifest;
+        if(!manifestFile.empty())
+            manifest = std::make_unique<emu::ManifestWriter>();
+        rc = disassembleOrAnalyze(scan, dumpDoubles, inputList, mode, jobs, numSlowest, cache.get(), index.get(), manifest.get(), shard ? &*shard : nullptr);
+        if(index && !index->write(buildIndexFile)) {
+            std::cerr << "ERROR: Couldn't write opcode index '" << buildIndexFile << "'" << std::endl;
+            rc = 1;
+        }
+        if(manifest && !manifest->write(manifestFile)) {
+            std::cerr << "ERROR: Couldn't write manifest '" << manifestFile << "'" << std::endl;
+            rc = 1;
+        }
+        if(cache && !cache->save())
+            std::cerr << "ERROR: Couldn't write scan cache '" << scanCacheFile << "'" << std::endl;
+    }
+    else {
         std::error_code ec;
         if(inputList.size() == 1 &&
             fs::exists(inputList.front(), ec) &&
@@ -424,95 +1764,41 @@ int main(int argc, char* argv[])
                 return 1;
             }
         }
-        try {
-            if (preprocess || cartridgeBuild) {
-                result = compiler.preprocessFiles(inputList);
-                if (result.resultType == emu::CompileResult::eOK) {
-                    std::ostringstream os;
-                    if(cartridgeBuild) {
-                        compiler.dumpSegments(os);
-                    }
-                    if (outputFile.empty())
-                        compiler.dumpSegments(std::cout);
-                    else {
-                        std::ofstream out(outputFile);
-                        compiler.dumpSegments(out);
-                    }
-                    if (outputFile.empty()) {
-                        std::cerr << "ERROR: No output filename given for cartridge output (use -o/--output)." << std::endl;
-                        return 1;
-                    }
-                    emu::OctoCartridge cart(outputFile);
-                    if(!cartridgeOptions.empty()) {
-                        if(!fs::exists(cartridgeOptions) || fs::is_directory(cartridgeOptions)) {
-                            std::cerr << "ERROR: Couldn't find JSON file '" << cartridgeOptions << "' with cartridge options." << std::endl;
-                            return 1;
-                        }
-                        else {
-                            auto optionsStr = loadTextFile(cartridgeOptions);
-                            try {
-                                auto json = nlohmann::json::parse(optionsStr);
-                                cart.setOptions(json);
-                            }
-                            catch(...) {
-                                std::cerr << "ERROR: Couldn't parse cartridge option file '" << cartridgeOptions << "'." << std::endl;
-                                return 1;
-                            }
-                        }
-                    }
-                    else if(!cartridgeVariant.empty()) {
-
-                    }
-                    else if(result.config) {
-                        cart.setOptions(result.config->at("options"));
-                    }
-                    cart.saveCartridge(os.str(), cartridgeLabel, {});
-                }
-            }
-            else {
-
-                result = compiler.compile(inputList);
-                if (result.resultType == emu::CompileResult::eOK) {
-                    if (outputFile.empty()) {
-                        std::cerr << "ERROR: No output filename given for binary output (use -o/--output)." << std::endl;
-                        return 1;
-                    }
-                    std::ofstream out(outputFile, std::ios::binary);
-                    out.write((const char*)compiler.code(), compiler.codeSize());
-                }
-            }
-            if (result.resultType != emu::CompileResult::eOK) {
-                if (result.locations.empty()) {
-                    std::cerr << "ERROR: " << result.errorMessage << std::endl;
+        // when watching, unchanged sources and images stay in memory between the builds
+        auto sourceCache = watch ? std::make_shared<emu::SourceCache>() : nullptr;
+        std::vector<std::string> dependencies;
+        emu::BuildTarget target{inputList, outputFile, includePaths, defineList, startAddress, preprocess, !noLineInfo, cartridgeBuild, cartridgeLabel, cartridgeOptions, depFile};
+        emu::OctoCompiler::ProgressHandler progress;
+        if(!quiet) {
+            progress = [&](int verbLvl, std::string msg) {
+                if (verbLvl <= verbosity) {
+                    logstream << std::string(verbLvl * 2 - 2, ' ') << msg << std::endl;
                 }
-                else {
-                    for (auto iter = result.locations.rbegin(); iter != result.locations.rend(); ++iter) {
-                        switch (iter->type) {
-                            case emu::CompileResult::Location::eINCLUDED:
-                                std::cerr << "In file included from " << iter->file << ":" << iter->line << ":" << std::endl;
-                                break;
-                            case emu::CompileResult::Location::eINSTANTIATED:
-                                std::cerr << "Instantiated at " << iter->file << ":" << iter->line << ":" << std::endl;
-                                break;
-                            default:
-                                std::cerr << iter->file << ":" << iter->line << ":";
-                                if (iter->column)
-                                    std::cerr << iter->column << ": ";
-                                std::cerr << result.errorMessage << "\n" << std::endl;
-                                break;
-                        }
-                    }
+            };
+        }
+        auto build = [&]() {
+            auto start = steady_clock::now();
+            auto buildRc = emu::buildTarget(target, sourceCache, std::cerr, progress, &dependencies);
+            auto duration = duration_cast<milliseconds>(steady_clock::now() - start).count();
+            if (!quiet)
+                logstream << "Duration: " << duration << "ms\n" << std::endl;
+            return buildRc;
+        };
+        rc = build();
+        if(watch) {
+            emu::FileWatcher watcher;
+            while(true) {
+                watcher.setFiles(dependencies.empty() ? inputList : dependencies);
+                if(!quiet)
+                    logstream << "Watching " << (dependencies.empty() ? inputList.size() : dependencies.size()) << " files for changes..." << std::endl;
+                auto changed = watcher.wait(10ms);
+                if(!quiet) {
+                    for(const auto& file : changed)
+                        logstream << "INFO: Changed: " << file << std::endl;
                 }
-                rc = -1;
+                rc = build();
             }
         }
-        catch (std::exception& ex) {
-            std::cerr << "Internal error: " << ex.what() << std::endl;
-            rc = -1;
-        }
-        auto duration = duration_cast<milliseconds>(steady_clock::now() - start).count();
-        if (!quiet)
-            logstream << "Duration: " << duration << "ms\n" << std::endl;
     }
     return rc;
 }
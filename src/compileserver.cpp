@@ -0,0 +1,356 @@
+//---------------------------------------------------------------------------------------
+// src/compileserver.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#include "compileserver.hpp"
+
+#include <chiplet/chip8decompiler.hpp>
+#include <chiplet/mappedfile.hpp>
+#include <chiplet/octocompiler.hpp>
+#include <chiplet/workstealingpool.hpp>
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace emu {
+
+namespace {
+
+const char* base64Chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64Encode(const uint8_t* data, size_t size)
+{
+    std::string result;
+    result.reserve((size + 2) / 3 * 4);
+    for(size_t i = 0; i < size; i += 3) {
+        uint32_t chunk = uint32_t(data[i]) << 16;
+        if(i + 1 < size)
+            chunk |= uint32_t(data[i + 1]) << 8;
+        if(i + 2 < size)
+            chunk |= data[i + 2];
+        result += base64Chars[(chunk >> 18) & 63];
+        result += base64Chars[(chunk >> 12) & 63];
+        result += i + 1 < size ? base64Chars[(chunk >> 6) & 63] : '=';
+        result += i + 2 < size ? base64Chars[chunk & 63] : '=';
+    }
+    return result;
+}
+
+bool base64Decode(const std::string& text, std::vector<uint8_t>& data)
+{
+    uint32_t chunk = 0;
+    int bits = 0;
+    for(auto c : text) {
+        if(c == '=')
+            break;
+        const auto* pos = std::strchr(base64Chars, c);
+        if(!c || !pos)
+            return false;
+        chunk = (chunk << 6) | uint32_t(pos - base64Chars);
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            data.push_back(uint8_t(chunk >> bits));
+        }
+    }
+    return true;
+}
+
+nlohmann::json resultRecord(const CompileResult& result)
+{
+    static const char* types[] = {"ok", "info", "warning", "error"};
+    static const char* locationTypes[] = {"root", "included", "instantiated"};
+    auto locations = nlohmann::json::array();
+    for(const auto& location : result.locations) {
+        locations.push_back({{"file", location.file}, {"line", location.line}, {"column", location.column}, {"type", locationTypes[location.type]}});
+    }
+    return {{"type", types[result.resultType]}, {"message", result.errorMessage}, {"locations", locations}};
+}
+
+}
+
+CompileServer::CompileServer(std::vector<std::string> includePaths, std::vector<std::string> defines)
+    : _includePaths(std::move(includePaths))
+    , _defines(std::move(defines))
+    , _cache(std::make_shared<SourceCache>())
+{
+    OctoCompiler::initializeTables();
+}
+
+nlohmann::json CompileServer::handle(const nlohmann::json& request)
+{
+    ++_requests;
+    nlohmann::json response;
+    try {
+        auto command = request.at("command").get<std::string>();
+        if(command == "compile")
+            response = compile(request, false);
+        else if(command == "preprocess")
+            response = compile(request, true);
+        else if(command == "disassemble")
+            response = disassemble(request);
+        else if(command == "status")
+            response = status();
+        else
+            response = {{"ok", false}, {"error", "Unknown command '" + command + "'"}};
+    }
+    catch(std::exception& ex) {
+        response = {{"ok", false}, {"error", ex.what()}};
+    }
+    if(request.is_object() && request.contains("id"))
+        response["id"] = request["id"];
+    return response;
+}
+
+std::string CompileServer::handleLine(const std::string& line)
+{
+    nlohmann::json request;
+    try {
+        request = nlohmann::json::parse(line);
+    }
+    catch(std::exception& ex) {
+        return nlohmann::json{{"ok", false}, {"error", std::string("Invalid request: ") + ex.what()}}.dump();
+    }
+    return handle(request).dump();
+}
+
+nlohmann::json CompileServer::compile(const nlohmann::json& request, bool preprocessOnly)
+{
+    OctoCompiler compiler;
+    compiler.setSourceCache(_cache);
+    compiler.setStartAddress(request.value("startAddress", 0x200));
+    compiler.generateLineInfos(request.value("lineInfo", true));
+    auto includePaths = _includePaths;
+    for(const auto& path : request.value("includePaths", std::vector<std::string>{})) {
+        includePaths.push_back(path);
+    }
+    compiler.setIncludePaths(includePaths);
+    for(const auto& define : _defines) {
+        compiler.define(define, 1);
+    }
+    for(const auto& define : request.value("defines", std::vector<std::string>{})) {
+        compiler.define(define, 1);
+    }
+    CompileResult result;
+    if(request.contains("source")) {
+        const auto& source = request.at("source").get_ref<const std::string&>();
+        auto file = request.value("file", std::string("source.8o"));
+        if(preprocessOnly)
+            result = compiler.preprocessFile(file, source.data(), source.data() + source.size());
+        else
+            result = compiler.compile(file, source.data(), source.data() + source.size());
+    }
+    else {
+        auto files = request.at("files").get<std::vector<std::string>>();
+        if(files.empty())
+            return {{"ok", false}, {"error", "No input files given"}};
+        result = preprocessOnly ? compiler.preprocessFiles(files) : compiler.compile(files);
+    }
+    nlohmann::json response = {{"ok", result.resultType == CompileResult::eOK}, {"result", resultRecord(result)}};
+    if(result.resultType != CompileResult::eOK)
+        return response;
+    if(preprocessOnly) {
+        std::ostringstream os;
+        compiler.dumpSegments(os);
+        response["output"] = os.str();
+    }
+    else {
+        response["rom"] = base64Encode(compiler.code(), compiler.codeSize());
+        response["size"] = compiler.codeSize();
+        response["sha1"] = compiler.sha1().to_hex();
+        response["sourceLines"] = compiler.numSourceLines();
+    }
+    return response;
+}
+
+nlohmann::json CompileServer::disassemble(const nlohmann::json& request)
+{
+    auto file = request.value("file", std::string("rom.ch8"));
+    std::vector<uint8_t> rom;
+    if(request.contains("rom")) {
+        if(!base64Decode(request.at("rom").get<std::string>(), rom))
+            return {{"ok", false}, {"error", "Invalid base64 ROM data"}};
+    }
+    else {
+        MappedFile data(file);
+        rom.assign(data.begin(), data.end());
+    }
+    if(rom.empty())
+        return {{"ok", false}, {"error", "Couldn't load ROM '" + file + "'"}};
+    auto startAddress = request.value("startAddress", uint16_t(0x200));
+    Chip8Decompiler dec;
+    std::ostringstream os;
+    dec.decompile(file, rom.data(), startAddress, uint32_t(rom.size()), startAddress, &os);
+    return {{"ok", true}, {"source", os.str()}};
+}
+
+nlohmann::json CompileServer::status() const
+{
+    return {{"ok", true}, {"requests", _requests.load()}, {"cacheHits", _cache->hits()}, {"cacheMisses", _cache->misses()}};
+}
+
+int CompileServer::serve(std::istream& in, std::ostream& out)
+{
+    std::string line;
+    while(std::getline(in, line)) {
+        if(line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        out << handleLine(line) << std::endl;
+    }
+    return 0;
+}
+
+int CompileServer::serveSocket(const std::string& socketPath)
+{
+#if defined(_WIN32)
+    (void)socketPath;
+    std::cerr << "ERROR: Serving on a unix domain socket is not supported on this platform" << std::endl;
+    return 1;
+#else
+    sockaddr_un address{};
+    if(socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "ERROR: Socket path '" << socketPath << "' is too long" << std::endl;
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    // a socket left over from a previous server would make bind fail, anything else at that
+    // path is most likely a typo and must not be deleted
+    struct stat st{};
+    if(::lstat(socketPath.c_str(), &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            std::cerr << "ERROR: '" << socketPath << "' exists and is not a socket" << std::endl;
+            return 1;
+        }
+        ::unlink(socketPath.c_str());
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    // the server reads any file its user can read, so only that user may connect
+    auto oldMask = ::umask(0177);
+    auto rc = fd < 0 ? -1 : ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    auto bindErrno = errno;
+    ::umask(oldMask);
+    errno = bindErrno;
+    if(rc != 0 || ::listen(fd, 16) != 0) {
+        std::cerr << "ERROR: Couldn't listen on socket '" << socketPath << "': " << std::strerror(errno) << std::endl;
+        if(fd >= 0)
+            ::close(fd);
+        return 1;
+    }
+    // a client closing its connection early must not end the server
+    std::signal(SIGPIPE, SIG_IGN);
+    {
+        // one worker per connection, further clients wait in the listen backlog
+        ghc::WorkStealingPool workers(MAX_CONNECTIONS);
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(_connectionMutex);
+                _connectionClosed.wait(lock, [this]() { return _connections.size() < MAX_CONNECTIONS; });
+            }
+            int client = ::accept(fd, nullptr, nullptr);
+            if(client < 0) {
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                std::cerr << "ERROR: Couldn't accept connection: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_connectionMutex);
+                _connections.insert(client);
+            }
+            workers.submit([this, client]() {
+                serveConnection(client);
+                std::lock_guard<std::mutex> lock(_connectionMutex);
+                _connections.erase(client);
+                ::close(client);
+                _connectionClosed.notify_one();
+            });
+        }
+        // let requests in flight finish but stop reading new ones, the workers are joined
+        // when the pool goes out of scope
+        std::lock_guard<std::mutex> lock(_connectionMutex);
+        for(auto client : _connections)
+            ::shutdown(client, SHUT_RD);
+    }
+    ::close(fd);
+    ::unlink(socketPath.c_str());
+    return 1;
+#endif
+}
+
+void CompileServer::serveConnection(int fd)
+{
+#if !defined(_WIN32)
+    auto send = [fd](const std::string& response) {
+        for(size_t written = 0; written < response.size();) {
+            auto rc = ::write(fd, response.data() + written, response.size() - written);
+            if(rc < 0 && errno == EINTR)
+                continue;
+            if(rc <= 0)
+                return false;
+            written += size_t(rc);
+        }
+        return true;
+    };
+    std::string buffer;
+    char chunk[4096];
+    bool open = true;
+    while(open) {
+        auto size = ::read(fd, chunk, sizeof(chunk));
+        if(size < 0 && errno == EINTR)
+            continue;
+        if(size <= 0)
+            break;
+        buffer.append(chunk, size_t(size));
+        size_t start = 0, end;
+        while(open && (end = buffer.find('\n', start)) != std::string::npos) {
+            auto line = buffer.substr(start, end - start);
+            start = end + 1;
+            if(line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            open = send(handleLine(line) + "\n");
+        }
+        buffer.erase(0, start);
+        // a client sending no newline mustn't make the server buffer without limit
+        if(open && buffer.size() > MAX_LINE_LENGTH) {
+            send(nlohmann::json{{"ok", false}, {"error", "Request exceeds " + std::to_string(MAX_LINE_LENGTH) + " bytes"}}.dump() + "\n");
+            break;
+        }
+    }
+#else
+    (void)fd;
+#endif
+}
+
+}
@@ -0,0 +1,76 @@
+//---------------------------------------------------------------------------------------
+// src/compileserver.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/sourcecache.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+// A long running compile server answering compile, preprocess and disassemble requests,
+// one JSON object per line, from a stream pair (stdin/stdout) or from the connections of
+// a unix domain socket, at most MAX_CONNECTIONS of them served at once. A connection
+// sending a line longer than MAX_LINE_LENGTH gets an error and is closed. The assembler
+// tables, the decompiler opcode tables and a SourceCache of all read source files and
+// images stay warm between requests, every request gets a fresh compiler though, so
+// requests don't influence each other.
+class CompileServer
+{
+public:
+    CompileServer(std::vector<std::string> includePaths, std::vector<std::string> defines);
+    nlohmann::json handle(const nlohmann::json& request);
+    std::string handleLine(const std::string& line);
+    int serve(std::istream& in, std::ostream& out);
+    int serveSocket(const std::string& socketPath);
+
+private:
+    nlohmann::json compile(const nlohmann::json& request, bool preprocessOnly);
+    nlohmann::json disassemble(const nlohmann::json& request);
+    nlohmann::json status() const;
+    void serveConnection(int fd);
+    static constexpr size_t MAX_CONNECTIONS = 16;
+    static constexpr size_t MAX_LINE_LENGTH = 32 * 1024 * 1024;
+    std::vector<std::string> _includePaths;
+    std::vector<std::string> _defines;
+    std::shared_ptr<SourceCache> _cache;
+    std::atomic<uint64_t> _requests{0};
+    std::mutex _connectionMutex;
+    std::condition_variable _connectionClosed;
+    std::set<int> _connections;
+};
+
+}
@@ -0,0 +1,177 @@
+//---------------------------------------------------------------------------------------
+// src/filewatcher.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+
+#include "filewatcher.hpp"
+
+#include <ghc/fs_fwd.hpp>
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = ghc::filesystem;
+
+namespace emu {
+
+FileWatcher::FileWatcher()
+{
+#if defined(__linux__)
+    _fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#if defined(__linux__)
+    if(_fd >= 0)
+        ::close(_fd);
+#endif
+}
+
+int64_t FileWatcher::stampOf(const std::string& path)
+{
+    std::error_code ec;
+    auto time = fs::last_write_time(path, ec);
+    if(ec)
+        return 0;
+    auto size = fs::file_size(path, ec);
+    return int64_t(time.time_since_epoch().count()) ^ (ec ? 0 : int64_t(size) << 40);
+}
+
+void FileWatcher::setFiles(const std::vector<std::string>& files)
+{
+    std::vector<Entry> entries;
+    for(const auto& file : files) {
+        auto path = fs::absolute(file).lexically_normal();
+        Entry entry{path.string(), path.parent_path().string(), path.filename().string(), stampOf(path.string())};
+#if defined(__linux__)
+        // adding a directory that is already watched gives the same descriptor and keeps
+        // its queued events, so changes made while the last build was running aren't lost
+        if(_fd >= 0)
+            entry.watch = ::inotify_add_watch(_fd, entry.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+#endif
+        entries.push_back(std::move(entry));
+    }
+#if defined(__linux__)
+    for(const auto& old : _entries) {
+        auto stillUsed = std::any_of(entries.begin(), entries.end(), [&](const Entry& entry) { return entry.watch == old.watch; });
+        if(old.watch >= 0 && !stillUsed)
+            ::inotify_rm_watch(_fd, old.watch);
+    }
+#endif
+    _entries = std::move(entries);
+}
+
+void FileWatcher::addChanged(std::vector<std::string>& changed, const std::string& path)
+{
+    if(std::find(changed.begin(), changed.end(), path) == changed.end())
+        changed.push_back(path);
+}
+
+bool FileWatcher::pollStamps(std::vector<std::string>& changed)
+{
+    bool seen = false;
+    for(auto& entry : _entries) {
+        if(entry.watch >= 0)
+            continue;
+        auto stamp = stampOf(entry.path);
+        if(stamp != entry.stamp) {
+            entry.stamp = stamp;
+            addChanged(changed, entry.path);
+            seen = true;
+        }
+    }
+    return seen;
+}
+
+bool FileWatcher::collect(std::vector<std::string>& changed, int timeoutMs)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    // entries without an inotify watch (no inotify, or adding the watch failed) are polled
+    auto polling = std::any_of(_entries.begin(), _entries.end(), [](const Entry& entry) { return entry.watch < 0; });
+    while(true) {
+        // any event for a watched file counts, even if it is already in changed, so
+        // repeated saves of the same file keep extending the debounce period
+        if(pollStamps(changed))
+            return true;
+        int remaining = -1;
+        if(timeoutMs >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count();
+            if(left <= 0)
+                return false;
+            remaining = int(left);
+        }
+        int step = polling ? (remaining < 0 ? 100 : std::min(remaining, 100)) : remaining;
+#if defined(__linux__)
+        if(_fd >= 0) {
+            struct pollfd pfd{_fd, POLLIN, 0};
+            bool seen = false;
+            if(::poll(&pfd, 1, step) > 0) {
+                alignas(struct inotify_event) char buffer[16 * 1024];
+                ssize_t length;
+                while((length = ::read(_fd, buffer, sizeof(buffer))) > 0) {
+                    for(char* ptr = buffer; ptr < buffer + length;) {
+                        const auto* event = reinterpret_cast<const struct inotify_event*>(ptr);
+                        if(event->len) {
+                            for(const auto& entry : _entries) {
+                                if(entry.watch == event->wd && entry.name == event->name) {
+                                    addChanged(changed, entry.path);
+                                    seen = true;
+                                }
+                            }
+                        }
+                        ptr += sizeof(struct inotify_event) + event->len;
+                    }
+                }
+            }
+            // events for other files in the watched directories just keep waiting
+            if(seen)
+                return true;
+            continue;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::milliseconds(step));
+    }
+}
+
+std::vector<std::string> FileWatcher::wait(std::chrono::milliseconds debounce)
+{
+    std::vector<std::string> changed;
+    if(_entries.empty())
+        return changed;
+    while(!collect(changed, -1)) {
+    }
+    while(collect(changed, int(debounce.count()))) {
+    }
+    return changed;
+}
+
+}
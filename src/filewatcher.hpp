@@ -0,0 +1,70 @@
+//---------------------------------------------------------------------------------------
+// src/filewatcher.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+// Blocks until one of a set of files changes. On Linux the parent directories of the
+// files are watched with inotify, so editors that save by writing a temporary file and
+// renaming it over the original are noticed as well, elsewhere (or for files whose
+// directory couldn't be watched) the modification times are polled. After the first
+// change wait() keeps collecting events until none for the watched files arrived for
+// the debounce period, so a burst of saves results in a single rebuild.
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    void setFiles(const std::vector<std::string>& files);
+    std::vector<std::string> wait(std::chrono::milliseconds debounce);
+
+private:
+    struct Entry
+    {
+        std::string path;
+        std::string directory;
+        std::string name;
+        int64_t stamp{0};
+        int watch{-1};
+    };
+    // true if an event for a watched file arrived within timeoutMs (negative: no limit)
+    bool collect(std::vector<std::string>& changed, int timeoutMs);
+    // true if a polled file changed since the last call
+    bool pollStamps(std::vector<std::string>& changed);
+    void addChanged(std::vector<std::string>& changed, const std::string& path);
+    static int64_t stampOf(const std::string& path);
+    std::vector<Entry> _entries;
+    int _fd{-1};
+};
+
+}
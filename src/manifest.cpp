@@ -0,0 +1,149 @@
+//---------------------------------------------------------------------------------------
+// src/manifest.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#include "manifest.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace emu {
+
+using namespace manifest;
+
+static uint64_t alignTo8(uint64_t offset)
+{
+    return (offset + 7) & ~uint64_t(7);
+}
+
+void ManifestWriter::addFile(const std::string& name, const Sha1::Digest& digest, uint32_t size, uint16_t startAddress, Chip8Variant variants, bool oddPc, uint32_t codeBytes, const std::map<uint16_t, int>& fullStats)
+{
+    _digests.push_back({digest.getHigh1(), digest.getHigh2(), digest.getLow(), 0});
+    _sizes.push_back(size);
+    _starts.push_back(startAddress);
+    _variants.push_back(static_cast<uint64_t>(variants));
+    _oddPc.push_back(oddPc ? 1 : 0);
+    _codeBytes.push_back(codeBytes);
+    _names += name;
+    _nameDirectory.push_back(uint32_t(_names.size()));
+    for(const auto& [opcode, count] : fullStats) {
+        _opcodes.push_back(opcode);
+        _counts.push_back(uint32_t(count));
+    }
+    _histogramDirectory.push_back(uint32_t(_opcodes.size()));
+}
+
+bool ManifestWriter::write(const std::string& manifestFile) const
+{
+    if(_names.size() > std::numeric_limits<uint32_t>::max() || _opcodes.size() > std::numeric_limits<uint32_t>::max())
+        return false;
+    std::pair<const void*, uint64_t> columns[NUM_COLUMNS];
+    columns[eSHA1] = {_digests.data(), _digests.size() * sizeof(Digest)};
+    columns[eSIZE] = {_sizes.data(), _sizes.size() * sizeof(uint32_t)};
+    columns[eSTART] = {_starts.data(), _starts.size() * sizeof(uint16_t)};
+    columns[eVARIANTS] = {_variants.data(), _variants.size() * sizeof(uint64_t)};
+    columns[eODD_PC] = {_oddPc.data(), _oddPc.size()};
+    columns[eCODE_BYTES] = {_codeBytes.data(), _codeBytes.size() * sizeof(uint32_t)};
+    columns[eNAME_DIRECTORY] = {_nameDirectory.data(), _nameDirectory.size() * sizeof(uint32_t)};
+    columns[eNAMES] = {_names.data(), _names.size()};
+    columns[eHISTOGRAM_DIRECTORY] = {_histogramDirectory.data(), _histogramDirectory.size() * sizeof(uint32_t)};
+    columns[eHISTOGRAM_OPCODES] = {_opcodes.data(), _opcodes.size() * sizeof(uint16_t)};
+    columns[eHISTOGRAM_COUNTS] = {_counts.data(), _counts.size() * sizeof(uint32_t)};
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.numRows = uint32_t(_sizes.size());
+    header.numDuplicates = _numDuplicates;
+    header.namesSize = _names.size();
+    header.numEntries = _opcodes.size();
+    uint64_t offset = alignTo8(sizeof(Header));
+    for(int column = 0; column < NUM_COLUMNS; ++column) {
+        header.columns[column] = offset;
+        offset = alignTo8(offset + columns[column].second);
+    }
+
+    std::ofstream os(manifestFile, std::ios::binary | std::ios::trunc);
+    auto pad = [&os](uint64_t offset) {
+        static const char zeros[8]{};
+        auto current = uint64_t(os.tellp());
+        os.write(zeros, std::streamsize(offset - current));
+    };
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(int column = 0; column < NUM_COLUMNS; ++column) {
+        pad(header.columns[column]);
+        os.write(static_cast<const char*>(columns[column].first), std::streamsize(columns[column].second));
+    }
+    pad(offset);
+    return bool(os);
+}
+
+bool Manifest::open(const std::string& manifestFile)
+{
+    _header = nullptr;
+    _data = MappedFile(manifestFile, std::numeric_limits<size_t>::max(), MappedFile::eMAP);
+    auto size = _data.size();
+    if(size < sizeof(Header))
+        return false;
+    const auto* header = reinterpret_cast<const Header*>(_data.data());
+    if(std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+        return false;
+    // bound the counts first, so the column sizes computed from them can't overflow
+    if(header->namesSize > size || header->numEntries > size / sizeof(uint32_t))
+        return false;
+    uint64_t rows = header->numRows;
+    const uint64_t columnSizes[NUM_COLUMNS] = {rows * sizeof(Digest), rows * sizeof(uint32_t), rows * sizeof(uint16_t), rows * sizeof(uint64_t), rows, rows * sizeof(uint32_t),
+                                               (rows + 1) * sizeof(uint32_t), header->namesSize, (rows + 1) * sizeof(uint32_t), header->numEntries * sizeof(uint16_t), header->numEntries * sizeof(uint32_t)};
+    for(int column = 0; column < NUM_COLUMNS; ++column) {
+        if(header->columns[column] % 8 || header->columns[column] > size || columnSizes[column] > size - header->columns[column])
+            return false;
+    }
+    auto column = [&](Column column) { return _data.data() + header->columns[column]; };
+    _digests = reinterpret_cast<const Digest*>(column(eSHA1));
+    _sizes = reinterpret_cast<const uint32_t*>(column(eSIZE));
+    _starts = reinterpret_cast<const uint16_t*>(column(eSTART));
+    _variants = reinterpret_cast<const uint64_t*>(column(eVARIANTS));
+    _oddPc = column(eODD_PC);
+    _codeBytes = reinterpret_cast<const uint32_t*>(column(eCODE_BYTES));
+    _nameDirectory = reinterpret_cast<const uint32_t*>(column(eNAME_DIRECTORY));
+    _names = reinterpret_cast<const char*>(column(eNAMES));
+    _histogramDirectory = reinterpret_cast<const uint32_t*>(column(eHISTOGRAM_DIRECTORY));
+    _opcodes = reinterpret_cast<const uint16_t*>(column(eHISTOGRAM_OPCODES));
+    _counts = reinterpret_cast<const uint32_t*>(column(eHISTOGRAM_COUNTS));
+    for(uint32_t row = 0; row < header->numRows; ++row) {
+        if(_nameDirectory[row] > _nameDirectory[row + 1] || _histogramDirectory[row] > _histogramDirectory[row + 1])
+            return false;
+    }
+    if(_nameDirectory[rows] > header->namesSize || _histogramDirectory[rows] > header->numEntries)
+        return false;
+    _header = header;
+    return true;
+}
+
+std::string_view Manifest::fileName(uint32_t row) const
+{
+    return {_names + _nameDirectory[row], _nameDirectory[row + 1] - _nameDirectory[row]};
+}
+
+}
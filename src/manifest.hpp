@@ -0,0 +1,134 @@
+//---------------------------------------------------------------------------------------
+// src/manifest.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/chip8variants.hpp>
+#include <chiplet/mappedfile.hpp>
+#include <chiplet/sha1.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+// On-disk layout of a corpus manifest, one row per unique ROM stored column by column,
+// all values in native byte order and every column 8 byte aligned, so a mapped manifest
+// can be queried without deserializing it:
+//
+//   Header | column[0] | column[1] | ... | column[NUM_COLUMNS - 1]
+//
+// The name and histogram columns are stored sparse: the names of row N are the bytes
+// [nameDirectory[N], nameDirectory[N+1]) of the names column, its used opcodes (sorted)
+// and their counts the entries [histogramDirectory[N], histogramDirectory[N+1]).
+namespace manifest {
+
+enum Column { eSHA1, eSIZE, eSTART, eVARIANTS, eODD_PC, eCODE_BYTES, eNAME_DIRECTORY, eNAMES, eHISTOGRAM_DIRECTORY, eHISTOGRAM_OPCODES, eHISTOGRAM_COUNTS, NUM_COLUMNS };
+
+struct Header
+{
+    char magic[8];
+    uint32_t numRows;
+    uint32_t numDuplicates;
+    uint64_t namesSize;
+    uint64_t numEntries;
+    uint64_t columns[NUM_COLUMNS];
+};
+
+// a SHA-1 digest with explicit padding, so the file content is deterministic
+struct Digest
+{
+    uint64_t high1;
+    uint64_t high2;
+    uint32_t low;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == 32 + NUM_COLUMNS * 8 && sizeof(Digest) == 24);
+
+inline constexpr char MAGIC[8] = {'C', '8', 'M', 'A', 'N', 'I', 'F', '1'};
+
+}
+
+// Collects the analysis results of unique ROMs and writes them as a corpus manifest.
+class ManifestWriter
+{
+public:
+    void addFile(const std::string& name, const Sha1::Digest& digest, uint32_t size, uint16_t startAddress, Chip8Variant variants, bool oddPc, uint32_t codeBytes, const std::map<uint16_t, int>& fullStats);
+    void addDuplicate() { ++_numDuplicates; }
+    bool write(const std::string& manifestFile) const;
+
+private:
+    std::vector<manifest::Digest> _digests;
+    std::vector<uint32_t> _sizes;
+    std::vector<uint16_t> _starts;
+    std::vector<uint64_t> _variants;
+    std::vector<uint8_t> _oddPc;
+    std::vector<uint32_t> _codeBytes;
+    std::vector<uint32_t> _nameDirectory{0};
+    std::string _names;
+    std::vector<uint32_t> _histogramDirectory{0};
+    std::vector<uint16_t> _opcodes;
+    std::vector<uint32_t> _counts;
+    uint32_t _numDuplicates{0};
+};
+
+// Read-only access to the columns of a memory mapped corpus manifest.
+class Manifest
+{
+public:
+    bool open(const std::string& manifestFile);
+    uint32_t numRows() const { return _header ? _header->numRows : 0; }
+    uint32_t numDuplicates() const { return _header ? _header->numDuplicates : 0; }
+    Sha1::Digest digest(uint32_t row) const { return {_digests[row].high1, _digests[row].high2, _digests[row].low}; }
+    std::string_view fileName(uint32_t row) const;
+    ghc::span<const uint32_t> sizes() const { return {_sizes, numRows()}; }
+    ghc::span<const uint16_t> startAddresses() const { return {_starts, numRows()}; }
+    ghc::span<const uint64_t> variants() const { return {_variants, numRows()}; }
+    ghc::span<const uint8_t> oddPc() const { return {_oddPc, numRows()}; }
+    ghc::span<const uint32_t> codeBytes() const { return {_codeBytes, numRows()}; }
+    ghc::span<const uint16_t> opcodes(uint32_t row) const { return {_opcodes + _histogramDirectory[row], _histogramDirectory[row + 1] - _histogramDirectory[row]}; }
+    ghc::span<const uint32_t> counts(uint32_t row) const { return {_counts + _histogramDirectory[row], _histogramDirectory[row + 1] - _histogramDirectory[row]}; }
+
+private:
+    MappedFile _data;
+    const manifest::Header* _header{nullptr};
+    const manifest::Digest* _digests{nullptr};
+    const uint32_t* _sizes{nullptr};
+    const uint16_t* _starts{nullptr};
+    const uint64_t* _variants{nullptr};
+    const uint8_t* _oddPc{nullptr};
+    const uint32_t* _codeBytes{nullptr};
+    const uint32_t* _nameDirectory{nullptr};
+    const char* _names{nullptr};
+    const uint32_t* _histogramDirectory{nullptr};
+    const uint16_t* _opcodes{nullptr};
+    const uint32_t* _counts{nullptr};
+};
+
+}
@@ -0,0 +1,353 @@
+//---------------------------------------------------------------------------------------
+// src/manifestquery.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#include "manifestquery.hpp"
+
+#include <chiplet/utility.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+struct VariantName
+{
+    const char* name;
+    Chip8Variant variant;
+};
+
+const VariantName variantNames[] = {
+    {"CHIP_8", C8V::CHIP_8}, {"CHIP_8_1_2", C8V::CHIP_8_1_2}, {"CHIP_8_I", C8V::CHIP_8_I}, {"CHIP_8_II", C8V::CHIP_8_II}, {"CHIP_8_III", C8V::CHIP_8_III},
+    {"CHIP_8_TPD", C8V::CHIP_8_TPD}, {"CHIP_8C", C8V::CHIP_8C}, {"CHIP_10", C8V::CHIP_10}, {"CHIP_8_SRV", C8V::CHIP_8_SRV}, {"CHIP_8_SRV_I", C8V::CHIP_8_SRV_I},
+    {"CHIP_8_RB", C8V::CHIP_8_RB}, {"CHIP_8_ARB", C8V::CHIP_8_ARB}, {"CHIP_8_FSD", C8V::CHIP_8_FSD}, {"CHIP_8_IOPD", C8V::CHIP_8_IOPD}, {"CHIP_8_8BMD", C8V::CHIP_8_8BMD},
+    {"HI_RES_CHIP_8", C8V::HI_RES_CHIP_8}, {"HI_RES_CHIP_8_IO", C8V::HI_RES_CHIP_8_IO}, {"HI_RES_CHIP_8_PS", C8V::HI_RES_CHIP_8_PS}, {"CHIP_8E", C8V::CHIP_8E},
+    {"CHIP_8_IBNNN", C8V::CHIP_8_IBNNN}, {"CHIP_8_SCROLL", C8V::CHIP_8_SCROLL}, {"CHIP_8X", C8V::CHIP_8X}, {"CHIP_8X_TPD", C8V::CHIP_8X_TPD}, {"HI_RES_CHIP_8X", C8V::HI_RES_CHIP_8X},
+    {"CHIP_8Y", C8V::CHIP_8Y}, {"CHIP_8_CTS", C8V::CHIP_8_CtS}, {"CHIP_BETA", C8V::CHIP_BETA}, {"CHIP_8M", C8V::CHIP_8M}, {"MULTIPLE_NIM", C8V::MULTIPLE_NIM},
+    {"DOUBLE_ARRAY_MOD", C8V::DOUBLE_ARRAY_MOD}, {"CHIP_8_D6800", C8V::CHIP_8_D6800}, {"CHIP_8_D6800_LOP", C8V::CHIP_8_D6800_LOP}, {"CHIP_8_D6800_JOY", C8V::CHIP_8_D6800_JOY},
+    {"CHIPOS_2K_D6800", C8V::CHIPOS_2K_D6800}, {"CHIP_8_ETI660", C8V::CHIP_8_ETI660}, {"CHIP_8_ETI660_COL", C8V::CHIP_8_ETI660_COL}, {"CHIP_8_ETI660_HR", C8V::CHIP_8_ETI660_HR},
+    {"CHIP_8_COSMAC_ELF", C8V::CHIP_8_COSMAC_ELF}, {"CHIP_8_ACE_VDU", C8V::CHIP_8_ACE_VDU}, {"CHIP_8_AE", C8V::CHIP_8_AE}, {"CHIP_8_DC_V2", C8V::CHIP_8_DC_V2},
+    {"CHIP_8_AMIGA", C8V::CHIP_8_AMIGA}, {"CHIP_48", C8V::CHIP_48}, {"SCHIP_1_0", C8V::SCHIP_1_0}, {"SCHIP_1_1", C8V::SCHIP_1_1}, {"GCHIP", C8V::GCHIP}, {"SCHIPC", C8V::SCHIPC},
+    {"SCHIPC_GCHIPC", C8V::SCHIPC_GCHIPC}, {"VIP2K_CHIP_8", C8V::VIP2K_CHIP_8}, {"SCHIP_1_1_SCRUP", C8V::SCHIP_1_1_SCRUP}, {"CHIP8RUN", C8V::CHIP8RUN}, {"MEGA_CHIP", C8V::MEGA_CHIP},
+    {"XO_CHIP", C8V::XO_CHIP}, {"OCTO", C8V::OCTO}, {"CHIP_8_CL_COL", C8V::CHIP_8_CL_COL}, {"SCHIP_MODERN", C8V::SCHIP_MODERN}};
+
+const std::pair<const char*, int> columnNames[] = {{"SIZE", 0}, {"START", 1}, {"VARIANTS", 2}, {"ODDPC", 3}, {"CODE", 4}, {"DATA", 5}, {"OPCODES", 6}};
+
+}
+
+// Recursive descent parser for the query grammar, from lowest to highest precedence:
+//
+//   or := and ("||" and)*    and := compare ("&&" compare)*    compare := bitor (op bitor)?
+//   bitor := bitand ("|" bitand)*    bitand := unary ("&" unary)*    unary := "!" unary | primary
+//   primary := number | column | variant | "uses" "(" pattern ")" | "(" or ")"
+class ManifestQuery::Parser
+{
+public:
+    Parser(const std::string& text, std::vector<Node>& nodes)
+        : _text(text)
+        , _nodes(nodes)
+    {
+    }
+    int parse()
+    {
+        auto root = parseOr();
+        skipSpace();
+        if(_pos < _text.size())
+            fail("unexpected '" + _text.substr(_pos, 1) + "'");
+        return root;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string& message) const { throw std::runtime_error(message + " at position " + std::to_string(_pos + 1)); }
+    void skipSpace()
+    {
+        while(_pos < _text.size() && std::isspace(uint8_t(_text[_pos])))
+            ++_pos;
+    }
+    bool accept(const char* token)
+    {
+        skipSpace();
+        auto length = std::char_traits<char>::length(token);
+        if(_text.compare(_pos, length, token) != 0)
+            return false;
+        // don't take the first half of "&&" or "||" as a bitwise operator
+        if(length == 1 && (token[0] == '&' || token[0] == '|') && _pos + 1 < _text.size() && _text[_pos + 1] == token[0])
+            return false;
+        _pos += length;
+        return true;
+    }
+    int add(Node node)
+    {
+        _nodes.push_back(node);
+        return int(_nodes.size() - 1);
+    }
+    int binary(Operation operation, int left, int right) { return add({operation, 0, 0, 0, left, right}); }
+    int parseOr()
+    {
+        auto left = parseAnd();
+        while(accept("||"))
+            left = binary(eOR, left, parseAnd());
+        return left;
+    }
+    int parseAnd()
+    {
+        auto left = parseCompare();
+        while(accept("&&"))
+            left = binary(eAND, left, parseCompare());
+        return left;
+    }
+    int parseCompare()
+    {
+        static const std::pair<const char*, Operation> operators[] = {{"==", eEQUAL}, {"!=", eNOT_EQUAL}, {"<=", eLESS_EQUAL}, {">=", eGREATER_EQUAL}, {"<", eLESS}, {">", eGREATER}};
+        auto left = parseBitOr();
+        for(const auto& [token, operation] : operators) {
+            if(accept(token))
+                return binary(operation, left, parseBitOr());
+        }
+        return left;
+    }
+    int parseBitOr()
+    {
+        auto left = parseBitAnd();
+        while(accept("|"))
+            left = binary(eBIT_OR, left, parseBitAnd());
+        return left;
+    }
+    int parseBitAnd()
+    {
+        auto left = parseUnary();
+        while(accept("&"))
+            left = binary(eBIT_AND, left, parseUnary());
+        return left;
+    }
+    int parseUnary()
+    {
+        if(accept("!"))
+            return add({eNOT, 0, 0, 0, parseUnary(), -1});
+        return parsePrimary();
+    }
+    int parsePrimary()
+    {
+        skipSpace();
+        if(accept("(")) {
+            auto node = parseOr();
+            if(!accept(")"))
+                fail("missing ')'");
+            return node;
+        }
+        if(_pos >= _text.size())
+            fail("unexpected end of query");
+        if(std::isdigit(uint8_t(_text[_pos]))) {
+            size_t length = 0;
+            int64_t value = 0;
+            try {
+                auto hex = _text.compare(_pos, 2, "0x") == 0 || _text.compare(_pos, 2, "0X") == 0;
+                value = std::stoll(_text.substr(_pos), &length, hex ? 16 : 10);
+            }
+            catch(...) {
+                fail("invalid number");
+            }
+            _pos += length;
+            return add({eCONSTANT, value});
+        }
+        auto start = _pos;
+        while(_pos < _text.size() && (std::isalnum(uint8_t(_text[_pos])) || _text[_pos] == '_'))
+            ++_pos;
+        if(start == _pos)
+            fail("unexpected '" + _text.substr(_pos, 1) + "'");
+        auto name = _text.substr(start, _pos - start);
+        std::transform(name.begin(), name.end(), name.begin(), [](char c) { return char(std::toupper(uint8_t(c))); });
+        if(name == "USES") {
+            if(!accept("("))
+                fail("expected '(' after uses");
+            skipSpace();
+            auto patternStart = _pos;
+            while(_pos < _text.size() && (isHexDigit(_text[_pos]) || _text[_pos] == '?' || _text[_pos] == 'x' || _text[_pos] == 'X'))
+                ++_pos;
+            auto pattern = _text.substr(patternStart, _pos - patternStart);
+            if(pattern.empty() || pattern.size() > 4)
+                fail("expected an opcode pattern like F?29");
+            if(!accept(")"))
+                fail("missing ')'");
+            auto normalized = (pattern + "????").substr(0, 4);
+            return add({eUSES, 0, opcodeFromPattern(normalized), maskFromPattern(normalized)});
+        }
+        for(const auto& [columnName, column] : columnNames) {
+            if(name == columnName)
+                return add({eCOLUMN, column});
+        }
+        for(const auto& [variantName, variant] : variantNames) {
+            if(name == variantName)
+                return add({eCONSTANT, int64_t(variant)});
+        }
+        _pos = start;
+        fail("unknown name '" + _text.substr(start, name.size()) + "'");
+    }
+    const std::string& _text;
+    std::vector<Node>& _nodes;
+    size_t _pos{0};
+};
+
+bool ManifestQuery::parse(const std::string& expression)
+{
+    _nodes.clear();
+    _error.clear();
+    try {
+        Parser parser(expression, _nodes);
+        _root = parser.parse();
+    }
+    catch(const std::runtime_error& ex) {
+        _nodes.clear();
+        _root = -1;
+        _error = ex.what();
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint32_t> ManifestQuery::select(const Manifest& manifest) const
+{
+    std::vector<uint32_t> rows(manifest.numRows());
+    for(uint32_t row = 0; row < rows.size(); ++row) {
+        rows[row] = row;
+    }
+    if(_root < 0)
+        return rows;
+    auto values = evaluate(_root, manifest, rows);
+    std::vector<uint32_t> selected;
+    for(size_t i = 0; i < rows.size(); ++i) {
+        if(values[i])
+            selected.push_back(rows[i]);
+    }
+    return selected;
+}
+
+std::vector<int64_t> ManifestQuery::evaluate(int index, const Manifest& manifest, const std::vector<uint32_t>& rows) const
+{
+    const auto& node = _nodes[index];
+    std::vector<int64_t> values(rows.size());
+    auto gather = [&](const auto& column) {
+        for(size_t i = 0; i < rows.size(); ++i) {
+            values[i] = int64_t(column[rows[i]]);
+        }
+    };
+    switch(node.operation) {
+        case eCONSTANT:
+            std::fill(values.begin(), values.end(), node.value);
+            break;
+        case eCOLUMN:
+            switch(node.value) {
+                case eSIZE: gather(manifest.sizes()); break;
+                case eSTART: gather(manifest.startAddresses()); break;
+                case eVARIANTS: gather(manifest.variants()); break;
+                case eODD_PC: gather(manifest.oddPc()); break;
+                case eCODE: gather(manifest.codeBytes()); break;
+                case eDATA:
+                    for(size_t i = 0; i < rows.size(); ++i) {
+                        values[i] = int64_t(manifest.sizes()[rows[i]]) - int64_t(manifest.codeBytes()[rows[i]]);
+                    }
+                    break;
+                case eOPCODES:
+                    for(size_t i = 0; i < rows.size(); ++i) {
+                        values[i] = int64_t(manifest.opcodes(rows[i]).size());
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case eUSES:
+            for(size_t i = 0; i < rows.size(); ++i) {
+                auto opcodes = manifest.opcodes(rows[i]);
+                auto counts = manifest.counts(rows[i]);
+                if(node.mask == 0xFFFF) {
+                    auto iter = std::lower_bound(opcodes.begin(), opcodes.end(), node.opcode);
+                    if(iter != opcodes.end() && *iter == node.opcode)
+                        values[i] = counts[size_t(iter - opcodes.begin())];
+                }
+                else {
+                    for(size_t entry = 0; entry < opcodes.size(); ++entry) {
+                        if((opcodes[entry] & node.mask) == node.opcode)
+                            values[i] += counts[entry];
+                    }
+                }
+            }
+            break;
+        case eNOT: {
+            auto operand = evaluate(node.left, manifest, rows);
+            for(size_t i = 0; i < rows.size(); ++i) {
+                values[i] = !operand[i];
+            }
+            break;
+        }
+        case eAND:
+        case eOR: {
+            // only the rows the left side doesn't decide get evaluated on the right side
+            auto left = evaluate(node.left, manifest, rows);
+            std::vector<uint32_t> undecided;
+            std::vector<size_t> positions;
+            for(size_t i = 0; i < rows.size(); ++i) {
+                if(bool(left[i]) == (node.operation == eAND)) {
+                    undecided.push_back(rows[i]);
+                    positions.push_back(i);
+                }
+                else {
+                    values[i] = node.operation == eOR;
+                }
+            }
+            if(!undecided.empty()) {
+                auto right = evaluate(node.right, manifest, undecided);
+                for(size_t i = 0; i < undecided.size(); ++i) {
+                    values[positions[i]] = right[i] != 0;
+                }
+            }
+            break;
+        }
+        default: {
+            auto left = evaluate(node.left, manifest, rows);
+            auto right = evaluate(node.right, manifest, rows);
+            for(size_t i = 0; i < rows.size(); ++i) {
+                switch(node.operation) {
+                    case eBIT_AND: values[i] = left[i] & right[i]; break;
+                    case eBIT_OR: values[i] = left[i] | right[i]; break;
+                    case eEQUAL: values[i] = left[i] == right[i]; break;
+                    case eNOT_EQUAL: values[i] = left[i] != right[i]; break;
+                    case eLESS: values[i] = left[i] < right[i]; break;
+                    case eLESS_EQUAL: values[i] = left[i] <= right[i]; break;
+                    case eGREATER: values[i] = left[i] > right[i]; break;
+                    case eGREATER_EQUAL: values[i] = left[i] >= right[i]; break;
+                    default: break;
+                }
+            }
+            break;
+        }
+    }
+    return values;
+}
+
+}
@@ -0,0 +1,72 @@
+//---------------------------------------------------------------------------------------
+// src/manifestquery.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include "manifest.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+// A predicate over the columns of a corpus manifest, like
+//
+//   variants & XO_CHIP && uses(F002) && size > 3584
+//
+// Operands are the columns size, start, variants, oddpc, code and data (code/data bytes),
+// opcodes (number of distinct opcodes used), uses(pattern) (number of uses of all opcodes
+// matching a -f style pattern), variant names like XO_CHIP and numbers. Operators are
+// ! & | == != < <= > >= && || and parentheses, with & and | binding tighter than the
+// comparisons. The query is evaluated column-wise, every node is computed for all
+// selected rows at once and the right side of && and || only for the undecided rows.
+class ManifestQuery
+{
+public:
+    bool parse(const std::string& expression);
+    const std::string& error() const { return _error; }
+    std::vector<uint32_t> select(const Manifest& manifest) const;
+
+private:
+    enum Operation { eCONSTANT, eCOLUMN, eUSES, eNOT, eAND, eOR, eBIT_AND, eBIT_OR, eEQUAL, eNOT_EQUAL, eLESS, eLESS_EQUAL, eGREATER, eGREATER_EQUAL };
+    enum Column { eSIZE, eSTART, eVARIANTS, eODD_PC, eCODE, eDATA, eOPCODES };
+    struct Node
+    {
+        Operation operation{eCONSTANT};
+        int64_t value{0};
+        uint16_t opcode{0};
+        uint16_t mask{0};
+        int left{-1};
+        int right{-1};
+    };
+    class Parser;
+    std::vector<int64_t> evaluate(int node, const Manifest& manifest, const std::vector<uint32_t>& rows) const;
+    std::vector<Node> _nodes;
+    int _root{-1};
+    std::string _error;
+};
+
+}
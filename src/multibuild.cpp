@@ -0,0 +1,300 @@
+//---------------------------------------------------------------------------------------
+// src/multibuild.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+
+#include "multibuild.hpp"
+
+#include <chiplet/octocartridge.hpp>
+#include <chiplet/trace.hpp>
+#include <chiplet/utility.hpp>
+#include <chiplet/workstealingpool.hpp>
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace emu {
+
+int buildTarget(const BuildTarget& target, const std::shared_ptr<SourceCache>& cache, std::ostream& errors, const OctoCompiler::ProgressHandler& progress, std::vector<std::string>* dependencies)
+{
+    int rc = 0;
+    OctoCompiler compiler;
+    compiler.setSourceCache(cache);
+    compiler.setStartAddress(target.startAddress);
+    compiler.generateLineInfos(target.lineInfo);
+    compiler.setIncludePaths(target.includePaths);
+    if(progress)
+        compiler.setProgressHandler(progress);
+    for(const auto& def : target.defines) {
+        compiler.define(def, 1);
+    }
+    CompileResult result;
+    try {
+        if (target.preprocess || target.cartridge) {
+            result = compiler.preprocessFiles(target.inputs);
+            if (result.resultType == CompileResult::eOK) {
+                std::ostringstream os;
+                if(target.cartridge) {
+                    compiler.dumpSegments(os);
+                }
+                if (target.output.empty())
+                    compiler.dumpSegments(std::cout);
+                else {
+                    CHIPLET_TRACE_SPAN("output", target.output);
+                    std::ofstream out(target.output);
+                    compiler.dumpSegments(out);
+                }
+                if(target.cartridge) {
+                    if (target.output.empty()) {
+                        errors << "ERROR: No output filename given for cartridge output (use -o/--output)." << std::endl;
+                        return 1;
+                    }
+                    OctoCartridge cart(target.output);
+                    if(!target.cartridgeOptions.empty()) {
+                        if(!fs::exists(target.cartridgeOptions) || fs::is_directory(target.cartridgeOptions)) {
+                            errors << "ERROR: Couldn't find JSON file '" << target.cartridgeOptions << "' with cartridge options." << std::endl;
+                            return 1;
+                        }
+                        else {
+                            auto optionsStr = loadTextFile(target.cartridgeOptions);
+                            try {
+                                auto json = nlohmann::json::parse(optionsStr);
+                                cart.setOptions(json);
+                            }
+                            catch(...) {
+                                errors << "ERROR: Couldn't parse cartridge option file '" << target.cartridgeOptions << "'." << std::endl;
+                                return 1;
+                            }
+                        }
+                    }
+                    else if(result.config) {
+                        cart.setOptions(result.config->at("options"));
+                    }
+                    cart.saveCartridge(os.str(), target.cartridgeLabel, {});
+                }
+            }
+        }
+        else {
+            result = compiler.compile(target.inputs);
+            if (result.resultType == CompileResult::eOK) {
+                if (target.output.empty()) {
+                    errors << "ERROR: No output filename given for binary output (use -o/--output)." << std::endl;
+                    return 1;
+                }
+                CHIPLET_TRACE_SPAN("output", target.output);
+                std::ofstream out(target.output, std::ios::binary);
+                out.write((const char*)compiler.code(), compiler.codeSize());
+            }
+        }
+        if (result.resultType != CompileResult::eOK) {
+            if (result.locations.empty()) {
+                errors << "ERROR: " << result.errorMessage << std::endl;
+            }
+            else {
+                for (auto iter = result.locations.rbegin(); iter != result.locations.rend(); ++iter) {
+                    switch (iter->type) {
+                        case CompileResult::Location::eINCLUDED:
+                            errors << "In file included from " << iter->file << ":" << iter->line << ":" << std::endl;
+                            break;
+                        case CompileResult::Location::eINSTANTIATED:
+                            errors << "Instantiated at " << iter->file << ":" << iter->line << ":" << std::endl;
+                            break;
+                        default:
+                            errors << iter->file << ":" << iter->line << ":";
+                            if (iter->column)
+                                errors << iter->column << ": ";
+                            errors << result.errorMessage << "\n" << std::endl;
+                            break;
+                    }
+                }
+            }
+            rc = -1;
+        }
+    }
+    catch (std::exception& ex) {
+        errors << "Internal error: " << ex.what() << std::endl;
+        rc = -1;
+    }
+    auto used = compiler.dependencies();
+    if(!target.cartridgeOptions.empty() && target.cartridge)
+        used.push_back(fs::absolute(target.cartridgeOptions).lexically_normal().string());
+    if(rc == 0 && !target.depFile.empty() && !writeDependencyFile(target.depFile, target.output, used)) {
+        errors << "ERROR: Couldn't write dependency file '" << target.depFile << "'" << std::endl;
+        rc = 1;
+    }
+    if(dependencies)
+        *dependencies = std::move(used);
+    return rc;
+}
+
+// Writes a Makefile style dependency file for make/ninja, with the paths relative to the
+// current directory where possible and spaces, '#' and '$' escaped like gcc does.
+bool writeDependencyFile(const std::string& depFile, const std::string& target, const std::vector<std::string>& dependencies)
+{
+    auto escape = [](const std::string& path) {
+        std::string result;
+        for(auto c : path) {
+            if(c == ' ' || c == '#')
+                result += '\\';
+            else if(c == '$')
+                result += '$';
+            result += c;
+        }
+        return result;
+    };
+    auto cwd = fs::current_path();
+    std::ofstream out(depFile);
+    out << escape(target) << ":";
+    for(const auto& dependency : dependencies) {
+        auto path = fs::path(dependency).lexically_proximate(cwd);
+        out << " \\\n  " << escape(path.generic_string());
+    }
+    out << std::endl;
+    return out.good();
+}
+
+MultiBuild::MultiBuild(std::vector<std::string> includePaths, std::vector<std::string> defines)
+    : _includePaths(std::move(includePaths))
+    , _defines(std::move(defines))
+    , _cache(std::make_shared<SourceCache>())
+{
+}
+
+bool MultiBuild::load(const std::string& manifestFile)
+{
+    _targets.clear();
+    if(!fs::exists(manifestFile) || fs::is_directory(manifestFile)) {
+        _error = fmt::format("Couldn't find build manifest '{}'", manifestFile);
+        return false;
+    }
+    auto base = fs::absolute(manifestFile).parent_path();
+    auto resolve = [&](const std::string& path) { return path.empty() ? path : (base / path).lexically_normal().string(); };
+    size_t index = 0;
+    try {
+        auto manifest = nlohmann::json::parse(loadTextFile(manifestFile));
+        auto includePaths = _includePaths;
+        auto defines = _defines;
+        nlohmann::json targets = manifest;
+        if(manifest.is_object()) {
+            for(const auto& path : manifest.value("includePaths", std::vector<std::string>{}))
+                includePaths.push_back(resolve(path));
+            for(const auto& define : manifest.value("defines", std::vector<std::string>{}))
+                defines.push_back(define);
+            targets = manifest.at("targets");
+        }
+        if(!targets.is_array() || targets.empty()) {
+            _error = fmt::format("Build manifest '{}' contains no targets", manifestFile);
+            return false;
+        }
+        for(const auto& entry : targets) {
+            ++index;
+            BuildTarget target;
+            for(const auto& input : entry.at("inputs").get<std::vector<std::string>>()) {
+                auto path = resolve(input);
+                if(fs::is_directory(path))
+                    path = (fs::path(path) / "index.8o").string();
+                target.inputs.push_back(path);
+            }
+            target.output = resolve(entry.at("output").get<std::string>());
+            target.includePaths = includePaths;
+            for(const auto& path : entry.value("includePaths", std::vector<std::string>{}))
+                target.includePaths.push_back(resolve(path));
+            target.defines = defines;
+            for(const auto& define : entry.value("defines", std::vector<std::string>{}))
+                target.defines.push_back(define);
+            target.startAddress = entry.value("startAddress", int64_t(0x200));
+            target.preprocess = entry.value("preprocess", false);
+            target.lineInfo = entry.value("lineInfo", true);
+            target.cartridgeLabel = entry.value("cartridgeLabel", std::string());
+            target.cartridge = !target.cartridgeLabel.empty();
+            target.cartridgeOptions = resolve(entry.value("cartridgeOptions", std::string()));
+            target.depFile = resolve(entry.value("depFile", std::string()));
+            if(target.inputs.empty() || target.output.empty()) {
+                _error = fmt::format("Target {} of build manifest '{}' needs inputs and an output", index, manifestFile);
+                return false;
+            }
+            for(const auto& other : _targets) {
+                if(other.output == target.output) {
+                    _error = fmt::format("Target {} of build manifest '{}' writes '{}' like an earlier one", index, manifestFile, target.output);
+                    return false;
+                }
+            }
+            _targets.push_back(std::move(target));
+        }
+    }
+    catch(std::exception& ex) {
+        _error = index ? fmt::format("Invalid target {} in build manifest '{}': {}", index, manifestFile, ex.what()) : fmt::format("Couldn't parse build manifest '{}': {}", manifestFile, ex.what());
+        _targets.clear();
+        return false;
+    }
+    return true;
+}
+
+int MultiBuild::build(size_t jobs, std::ostream& log, bool quiet)
+{
+    using namespace std::chrono;
+    struct Outcome
+    {
+        int rc{0};
+        std::string errors;
+        int64_t durationMs{0};
+    };
+    auto start = steady_clock::now();
+    std::vector<Outcome> outcomes(_targets.size());
+    {
+        ghc::WorkStealingPool pool(jobs > 1 ? jobs : 0);
+        for(size_t i = 0; i < _targets.size(); ++i) {
+            pool.submit([this, i, &outcomes]() {
+                CHIPLET_TRACE_SPAN("target", _targets[i].output);
+                auto targetStart = steady_clock::now();
+                std::ostringstream errors;
+                outcomes[i].rc = buildTarget(_targets[i], _cache, errors);
+                outcomes[i].errors = errors.str();
+                outcomes[i].durationMs = duration_cast<milliseconds>(steady_clock::now() - targetStart).count();
+            });
+        }
+        pool.wait();
+    }
+    // reported in manifest order, so the output doesn't depend on the scheduling
+    size_t failed = 0;
+    for(size_t i = 0; i < _targets.size(); ++i) {
+        std::cerr << outcomes[i].errors;
+        if(outcomes[i].rc)
+            ++failed;
+        if(!quiet)
+            log << fmt::format("    {}: {} ({}ms)", _targets[i].output, outcomes[i].rc ? "failed" : "ok", outcomes[i].durationMs) << std::endl;
+    }
+    if(!quiet) {
+        auto duration = duration_cast<milliseconds>(steady_clock::now() - start).count();
+        log << fmt::format("Built {} of {} targets, {} failed, {} files loaded for {} uses ({}ms)", _targets.size() - failed, _targets.size(), failed, _cache->misses(), _cache->hits() + _cache->misses(), duration) << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
+}
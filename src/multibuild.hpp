@@ -0,0 +1,83 @@
+//---------------------------------------------------------------------------------------
+// src/multibuild.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/octocompiler.hpp>
+#include <chiplet/sourcecache.hpp>
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+// One program to build, either from the command line or from an entry of a build manifest.
+struct BuildTarget
+{
+    std::vector<std::string> inputs;
+    std::string output;
+    std::vector<std::string> includePaths;
+    std::vector<std::string> defines;
+    int64_t startAddress{0x200};
+    bool preprocess{false};
+    bool lineInfo{true};
+    bool cartridge{false};
+    std::string cartridgeLabel;
+    std::string cartridgeOptions;
+    std::string depFile;
+};
+
+// Builds a single target on its own compiler, reporting errors to the given stream. Returns
+// 0 on success, -1 for errors in the program and 1 for anything else. A preprocessed target
+// without output is written to stdout.
+int buildTarget(const BuildTarget& target, const std::shared_ptr<SourceCache>& cache, std::ostream& errors, const OctoCompiler::ProgressHandler& progress = {}, std::vector<std::string>* dependencies = nullptr);
+
+bool writeDependencyFile(const std::string& depFile, const std::string& target, const std::vector<std::string>& dependencies);
+
+// Builds all targets of a JSON build manifest concurrently, every target on its own
+// compiler, all of them sharing one SourceCache, so include files and images used by
+// many targets are only loaded and decoded once. Relative paths in the manifest are
+// relative to the directory of the manifest file.
+class MultiBuild
+{
+public:
+    MultiBuild(std::vector<std::string> includePaths, std::vector<std::string> defines);
+    bool load(const std::string& manifestFile);
+    const std::string& error() const { return _error; }
+    const std::vector<BuildTarget>& targets() const { return _targets; }
+    int build(size_t jobs, std::ostream& log, bool quiet);
+
+private:
+    std::vector<std::string> _includePaths;
+    std::vector<std::string> _defines;
+    std::vector<BuildTarget> _targets;
+    std::shared_ptr<SourceCache> _cache;
+    std::string _error;
+};
+
+}
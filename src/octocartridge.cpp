@@ -416,11 +416,13 @@ bool OctoCartridge::saveCartridge(std::string_view programSource, const std::str
     if(!label.empty()){
         printLabel(label);
     }
-    auto numColors = std::min(_palette.size(),static_cast<std::vector<uint32_t>::size_type>(16));
+    auto basePalette = _palette;
+    auto numColors = std::min(basePalette.size(),static_cast<std::vector<uint32_t>::size_type>(16));
+    _palette.resize(numColors * 16);
     for (int c = 0; c < numColors; c++) {
         // use 1 bit from the red/blue channels and 2 from the green channel to store data:
         for (int x = 0; x < 16; x++) {
-            _palette[(16 * c) + x] = (_palette[c] & 0xFEFCFE) | ((x & 0x8) << 13) | ((x & 0x6) << 7) | (x & 1);
+            _palette[(16 * c) + x] = (basePalette[c] & 0xFEFCFE) | ((x & 0x8) << 13) | ((x & 0x6) << 7) | (x & 1);
         }
     }
     auto json = nlohmann::json{
@@ -29,16 +29,16 @@
 #include <chiplet/octocompiler.hpp>
 #include <chiplet/chip8compiler.hpp>
 #include <chiplet/chip8meta.hpp>
+#include <chiplet/sourcecache.hpp>
+#include <chiplet/trace.hpp>
 
 #include <fmt/format.h>
 
-//#define STB_IMAGE_IMPLEMENTATION
-#include <chiplet/stb_image.h>
-
 #include <algorithm>
 #include <charconv>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <unordered_set>
 
 #include <nlohmann/json.hpp>
@@ -72,20 +72,6 @@ inline std::vector<std::string> split(const std::string &s, char delimiter) {
     return result;
 }
 
-inline std::string loadTextFile(const std::string& file)
-{
-    std::ifstream is(file, std::ios::binary | std::ios::ate);
-    std::streamsize size = is.tellg();
-    is.seekg(0, std::ios::beg);
-
-    std::string result(size, '\0');
-    if (is.read(result.data(), size)) {
-        return result;
-    }
-
-    return {};
-}
-
 }
 
 namespace emu {
@@ -114,7 +100,8 @@ std::unordered_map<std::string_view, OctoCompiler::OpcodeList> OctoCompiler::_mn
 
 void OctoCompiler::initializeTables()
 {
-    if(_assemblerLookupTable.empty()) {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
         for (const auto& info : detail::opcodes) {
             auto tokens = split(info.octo, ' ');
             if (!startsWith(info.octo, "vX") && !startsWith(info.octo, "i ") && !startsWith(info.octo, "0x")) {
@@ -130,7 +117,7 @@ void OctoCompiler::initializeTables()
                 _operators[std::string_view{info.octo.data() + tokens[0].size() + 1, tokens[1].size()}].emplace_back(tokens, &info);
             }
         }
-    }
+    });
 }
 
 OctoCompiler::OctoCompiler(Mode mode)
@@ -659,6 +646,7 @@ void OctoCompiler::reset()
     _collect.clear();
     _currentSegment = eCODE;
     _compileResult.reset();
+    _dependencies.clear();
 }
 
 void OctoCompiler::error(std::string msg)
@@ -699,6 +687,7 @@ size_t OctoCompiler::numSourceLines() const
 
 const CompileResult& OctoCompiler::preprocessFile(const std::string& inputFile, const char* source, const char* end)
 {
+    CHIPLET_TRACE_SPAN("preprocess", inputFile);
     if(end - source >= 3 && *source == (char)0xef && *(source+1) == (char)0xbb && *(source+2) == (char)0xbf)
         source += 3; // skip BOM
 
@@ -879,14 +868,22 @@ std::string OctoCompiler::resolveFile(const fs::path& file)
     return "";
 }
 
+void OctoCompiler::addDependency(const std::string& file)
+{
+    auto path = fs::absolute(file).lexically_normal().string();
+    if(std::find(_dependencies.begin(), _dependencies.end(), path) == _dependencies.end())
+        _dependencies.push_back(path);
+}
+
 const CompileResult& OctoCompiler::preprocessFile(const std::string& inputFile)
 {
     try {
         auto file = resolveFile(inputFile);
         if (_progress)
             _progress(_lexerStack.size() + 1, "preprocessing '" + inputFile + "' ...");
-        auto content = loadTextFile(inputFile);
-        preprocessFile(inputFile, content.data(), content.data() + content.size());
+        addDependency(inputFile);
+        auto content = _sourceCache ? _sourceCache->text(inputFile) : SourceCache::loadText(inputFile);
+        preprocessFile(inputFile, content->data(), content->data() + content->size());
     }
     catch(std::runtime_error& ex)
     {
@@ -971,7 +968,6 @@ bool OctoCompiler::isImage(const std::string& extension)
 
 OctoCompiler::Token::Type OctoCompiler::includeImage(std::string filename)
 {
-    int width,height,numChannels;
     int widthHint = -1, heightHint = -1;
     bool genLabels = true;
     bool debug = false;
@@ -998,10 +994,13 @@ OctoCompiler::Token::Type OctoCompiler::includeImage(std::string filename)
         }
         token = lex.nextToken(true);
     }
-    auto* data = stbi_load(filename.c_str(), &width, &height, &numChannels, 1);
-    if(!data) {
+    addDependency(filename);
+    auto image = _sourceCache ? _sourceCache->image(filename) : SourceCache::loadImage(filename);
+    if(!image) {
         error(fmt::format("Could not load image: '{}'", filename));
     }
+    const auto* data = image->pixels.data();
+    int width = image->width, height = image->height;
     int spriteWidth, spriteHeight;
     if(widthHint > 0) {
         spriteWidth = widthHint;
@@ -1048,7 +1047,6 @@ OctoCompiler::Token::Type OctoCompiler::includeImage(std::string filename)
             }
         }
     }
-    stbi_image_free(data);
     return token;
 }
 
@@ -1078,6 +1076,7 @@ static int whitespaceLinesAtStart(const std::string& text)
 
 void OctoCompiler::dumpSegments(std::ostream& output)
 {
+    CHIPLET_TRACE_SPAN("dumpSegments");
     int endingWSLines = 2;
     for(auto& segment : _codeSegments) {
         if(!segment.empty()) {
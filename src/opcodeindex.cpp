@@ -0,0 +1,149 @@
+//---------------------------------------------------------------------------------------
+// src/opcodeindex.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+
+#include "opcodeindex.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace emu {
+
+using namespace opcodeindex;
+
+static uint64_t alignTo8(uint64_t offset)
+{
+    return (offset + 7) & ~uint64_t(7);
+}
+
+OpcodeIndexWriter::OpcodeIndexWriter()
+    : _postings(0x10000)
+{
+}
+
+void OpcodeIndexWriter::addFile(const std::string& name, uint64_t size, Chip8Variant variants, const std::map<uint16_t, int>& fullStats)
+{
+    auto file = uint32_t(_files.size());
+    _files.push_back({static_cast<uint64_t>(variants), uint32_t(_names.size()), uint32_t(name.size()), uint32_t(size), uint32_t(fullStats.size())});
+    _names += name;
+    for(const auto& [opcode, count] : fullStats) {
+        _postings[opcode].push_back({file, uint32_t(count)});
+    }
+}
+
+bool OpcodeIndexWriter::write(const std::string& indexFile) const
+{
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.numFiles = uint32_t(_files.size());
+    header.numDuplicates = _numDuplicates;
+    header.filesOffset = alignTo8(sizeof(Header));
+    header.namesOffset = header.filesOffset + _files.size() * sizeof(FileRecord);
+    header.directoryOffset = alignTo8(header.namesOffset + _names.size());
+    header.postingsOffset = alignTo8(header.directoryOffset + 0x10001 * sizeof(uint32_t));
+    std::vector<uint32_t> directory;
+    directory.reserve(0x10001);
+    uint64_t numPostings = 0;
+    for(const auto& list : _postings) {
+        directory.push_back(uint32_t(numPostings));
+        numPostings += list.size();
+    }
+    if(numPostings > std::numeric_limits<uint32_t>::max())
+        return false;
+    directory.push_back(uint32_t(numPostings));
+    header.numPostings = numPostings;
+
+    std::ofstream os(indexFile, std::ios::binary | std::ios::trunc);
+    auto pad = [&os](uint64_t offset) {
+        static const char zeros[8]{};
+        auto current = uint64_t(os.tellp());
+        os.write(zeros, std::streamsize(offset - current));
+    };
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pad(header.filesOffset);
+    os.write(reinterpret_cast<const char*>(_files.data()), std::streamsize(_files.size() * sizeof(FileRecord)));
+    os.write(_names.data(), std::streamsize(_names.size()));
+    pad(header.directoryOffset);
+    os.write(reinterpret_cast<const char*>(directory.data()), std::streamsize(directory.size() * sizeof(uint32_t)));
+    pad(header.postingsOffset);
+    for(const auto& list : _postings) {
+        os.write(reinterpret_cast<const char*>(list.data()), std::streamsize(list.size() * sizeof(Posting)));
+    }
+    return bool(os);
+}
+
+bool OpcodeIndex::open(const std::string& indexFile)
+{
+    _header = nullptr;
+    _data = MappedFile(indexFile, std::numeric_limits<size_t>::max(), MappedFile::eMAP);
+    auto size = _data.size();
+    if(size < sizeof(Header))
+        return false;
+    const auto* header = reinterpret_cast<const Header*>(_data.data());
+    if(std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+        return false;
+    if((header->filesOffset | header->directoryOffset | header->postingsOffset) % 8)
+        return false;
+    if(header->filesOffset > size || uint64_t(header->numFiles) * sizeof(FileRecord) > size - header->filesOffset || header->namesOffset > size ||
+       header->directoryOffset > size || 0x10001 * sizeof(uint32_t) > size - header->directoryOffset || header->postingsOffset > size ||
+       header->numPostings > (size - header->postingsOffset) / sizeof(Posting))
+        return false;
+    _files = reinterpret_cast<const FileRecord*>(_data.data() + header->filesOffset);
+    _names = reinterpret_cast<const char*>(_data.data() + header->namesOffset);
+    _directory = reinterpret_cast<const uint32_t*>(_data.data() + header->directoryOffset);
+    _postings = reinterpret_cast<const Posting*>(_data.data() + header->postingsOffset);
+    if(_directory[0] != 0 || _directory[0x10000] != header->numPostings)
+        return false;
+    for(uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+        if(_directory[opcode] > _directory[opcode + 1])
+            return false;
+    }
+    for(uint64_t i = 0; i < header->numPostings; ++i) {
+        if(_postings[i].file >= header->numFiles)
+            return false;
+    }
+    for(uint32_t i = 0; i < header->numFiles; ++i) {
+        if(header->namesOffset + _files[i].nameOffset + _files[i].nameLength > header->directoryOffset)
+            return false;
+    }
+    _header = header;
+    return true;
+}
+
+std::string_view OpcodeIndex::fileName(uint32_t file) const
+{
+    return {_names + _files[file].nameOffset, _files[file].nameLength};
+}
+
+ghc::span<const Posting> OpcodeIndex::postings(uint16_t opcode) const
+{
+    if(!_header)
+        return {};
+    auto first = _directory[opcode];
+    return ghc::span<const Posting>(_postings + first, _directory[opcode + 1] - first);
+}
+
+}
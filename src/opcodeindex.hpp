@@ -0,0 +1,117 @@
+//---------------------------------------------------------------------------------------
+// src/opcodeindex.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/chip8variants.hpp>
+#include <chiplet/mappedfile.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+// On-disk layout of an opcode index, all values in native byte order and every section
+// 8 byte aligned, so a mapped index file can be used without deserializing it:
+//
+//   Header | FileRecord[numFiles] | names | uint32_t directory[65537] | Posting[numPostings]
+//
+// The postings of opcode N are [directory[N], directory[N+1]), sorted by file id.
+namespace opcodeindex {
+
+struct Header
+{
+    char magic[8];
+    uint32_t numFiles;
+    uint32_t numDuplicates;
+    uint64_t filesOffset;
+    uint64_t namesOffset;
+    uint64_t directoryOffset;
+    uint64_t postingsOffset;
+    uint64_t numPostings;
+};
+
+struct FileRecord
+{
+    uint64_t variants;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t size;
+    uint32_t numOpcodes;
+};
+
+struct Posting
+{
+    uint32_t file;
+    uint32_t count;
+};
+
+static_assert(sizeof(Header) == 56 && sizeof(FileRecord) == 24 && sizeof(Posting) == 8);
+
+inline constexpr char MAGIC[8] = {'C', '8', 'O', 'P', 'I', 'D', 'X', '1'};
+
+}
+
+// Collects the opcode statistics of analysed files and writes them as an opcode index.
+class OpcodeIndexWriter
+{
+public:
+    OpcodeIndexWriter();
+    void addFile(const std::string& name, uint64_t size, Chip8Variant variants, const std::map<uint16_t, int>& fullStats);
+    void addDuplicate() { ++_numDuplicates; }
+    bool write(const std::string& indexFile) const;
+
+private:
+    std::vector<opcodeindex::FileRecord> _files;
+    std::string _names;
+    std::vector<std::vector<opcodeindex::Posting>> _postings;
+    uint32_t _numDuplicates{0};
+};
+
+// Read-only access to a memory mapped opcode index.
+class OpcodeIndex
+{
+public:
+    bool open(const std::string& indexFile);
+    uint32_t numFiles() const { return _header ? _header->numFiles : 0; }
+    uint32_t numDuplicates() const { return _header ? _header->numDuplicates : 0; }
+    std::string_view fileName(uint32_t file) const;
+    Chip8Variant variants(uint32_t file) const { return static_cast<Chip8Variant>(_files[file].variants); }
+    uint32_t fileSize(uint32_t file) const { return _files[file].size; }
+    ghc::span<const opcodeindex::Posting> postings(uint16_t opcode) const;
+
+private:
+    MappedFile _data;
+    const opcodeindex::Header* _header{nullptr};
+    const opcodeindex::FileRecord* _files{nullptr};
+    const char* _names{nullptr};
+    const uint32_t* _directory{nullptr};
+    const opcodeindex::Posting* _postings{nullptr};
+};
+
+}
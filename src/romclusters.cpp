@@ -0,0 +1,159 @@
+//---------------------------------------------------------------------------------------
+// src/romclusters.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+
+#include "romclusters.hpp"
+#include "subroutineindex.hpp"
+
+#include <chiplet/utility.hpp>
+
+#include <ghc/span.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <unordered_map>
+
+namespace emu {
+
+// the parameters of the NUM_HASHES hash functions (a * h + b) >> 32, fixed so signatures are reproducible
+static const std::array<std::pair<uint64_t, uint64_t>, RomClusters::NUM_HASHES>& hashParameters()
+{
+    static const auto parameters = [] {
+        std::array<std::pair<uint64_t, uint64_t>, RomClusters::NUM_HASHES> result{};
+        uint64_t state = 0x43484950382d3135ull;
+        for(auto& [a, b] : result) {
+            a = mixHash64(state += 0x9E3779B97F4A7C15ull) | 1;
+            b = mixHash64(state += 0x9E3779B97F4A7C15ull);
+        }
+        return result;
+    }();
+    return parameters;
+}
+
+bool RomClusters::signature(const std::vector<Code>& chunks, Signature& signature)
+{
+    const auto& parameters = hashParameters();
+    signature.fill(std::numeric_limits<uint32_t>::max());
+    bool hasCode = false;
+    auto addShingle = [&](uint64_t shingle) {
+        auto hash = mixHash64(shingle);
+        for(size_t i = 0; i < NUM_HASHES; ++i) {
+            signature[i] = std::min(signature[i], uint32_t((parameters[i].first * hash + parameters[i].second) >> 32));
+        }
+        hasCode = true;
+    };
+    std::vector<uint16_t> words;
+    for(const auto& code : chunks) {
+        words.clear();
+        for(const auto& [opcode, next] : code) {
+            words.push_back(SubroutineIndex::normalizeOpcode(opcode, false));
+        }
+        if(words.empty())
+            continue;
+        // chunks shorter than an n-gram are a shingle of their own, tagged by their length
+        uint64_t shingle = 0;
+        for(size_t i = 0; i < words.size(); ++i) {
+            shingle = (shingle << 16) | words[i];
+            if(i + 1 >= NGRAM)
+                addShingle(shingle);
+        }
+        if(words.size() < NGRAM)
+            addShingle(shingle ^ (uint64_t(words.size()) << 60));
+    }
+    return hasCode;
+}
+
+double RomClusters::similarity(const Signature& a, const Signature& b)
+{
+    size_t equal = 0;
+    for(size_t i = 0; i < NUM_HASHES; ++i) {
+        equal += a[i] == b[i];
+    }
+    return double(equal) / NUM_HASHES;
+}
+
+void RomClusters::add(const std::string& name, const Signature& signature)
+{
+    _files.push_back(name);
+    _signatures.push_back(signature);
+}
+
+uint32_t RomClusters::find(uint32_t file) const
+{
+    while(_parent[file] != file) {
+        _parent[file] = _parent[_parent[file]];
+        file = _parent[file];
+    }
+    return file;
+}
+
+std::vector<RomClusters::Cluster> RomClusters::clusters() const
+{
+    auto numFiles = uint32_t(_files.size());
+    _parent.resize(numFiles);
+    for(uint32_t i = 0; i < numFiles; ++i) {
+        _parent[i] = i;
+    }
+    // every band of a signature is a bucket key, ROMs sharing a bucket are candidates and
+    // get joined if their estimated similarity reaches the threshold
+    for(size_t band = 0; band < BANDS; ++band) {
+        std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+        for(uint32_t file = 0; file < numFiles; ++file) {
+            uint64_t key = band;
+            for(size_t row = 0; row < ROWS; ++row) {
+                key = mixHash64(key ^ _signatures[file][band * ROWS + row]);
+            }
+            auto& bucket = buckets[key];
+            // a bucket of similar ROMs joins on the first compare, limiting the compares
+            // keeps degenerated buckets of short, dissimilar programs linear
+            auto compares = std::min(bucket.size(), MAX_BUCKET_COMPARES);
+            for(auto other : ghc::span<const uint32_t>(bucket.data() + bucket.size() - compares, compares)) {
+                if(similarity(_signatures[file], _signatures[other]) >= THRESHOLD) {
+                    auto rootA = find(file), rootB = find(other);
+                    _parent[std::max(rootA, rootB)] = std::min(rootA, rootB);
+                    break;
+                }
+            }
+            bucket.push_back(file);
+        }
+    }
+    std::map<uint32_t, Cluster> groups;
+    for(uint32_t file = 0; file < numFiles; ++file) {
+        auto root = find(file);
+        groups[root].push_back({file, similarity(_signatures[file], _signatures[root])});
+    }
+    std::vector<Cluster> result;
+    for(auto& [root, cluster] : groups) {
+        if(cluster.size() < 2)
+            continue;
+        std::stable_sort(cluster.begin() + 1, cluster.end(), [](const Member& a, const Member& b) { return a.similarity > b.similarity; });
+        result.push_back(std::move(cluster));
+    }
+    std::stable_sort(result.begin(), result.end(), [](const Cluster& a, const Cluster& b) { return a.size() > b.size(); });
+    return result;
+}
+
+}
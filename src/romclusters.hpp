@@ -0,0 +1,76 @@
+//---------------------------------------------------------------------------------------
+// src/romclusters.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace emu {
+
+// Groups near-duplicate ROMs (hacks, retitled or padded copies) by the MinHash signatures
+// of the opcode n-grams of their code. Signatures are bucketed with locality sensitive
+// hashing, so only ROMs sharing a bucket are ever compared and clustering stays roughly
+// linear in the number of ROMs.
+class RomClusters
+{
+public:
+    static constexpr size_t NGRAM = 4;
+    static constexpr size_t NUM_HASHES = 64;
+    static constexpr size_t BANDS = 16;
+    static constexpr size_t ROWS = NUM_HASHES / BANDS;
+    static constexpr double THRESHOLD = 0.5;
+    static constexpr size_t MAX_BUCKET_COMPARES = 16;
+    using Signature = std::array<uint32_t, NUM_HASHES>;
+    using Code = std::vector<std::pair<uint16_t, int>>;
+    struct Member
+    {
+        uint32_t file;
+        double similarity;
+    };
+    using Cluster = std::vector<Member>;
+
+    // Calculates the signature over the n-grams of the given code chunks, addresses of jumps,
+    // calls and I loads are ignored so relocated code still matches. Returns false if there
+    // is no code at all.
+    static bool signature(const std::vector<Code>& chunks, Signature& signature);
+    static double similarity(const Signature& a, const Signature& b);
+    void add(const std::string& name, const Signature& signature);
+    const std::string& fileName(uint32_t file) const { return _files[file]; }
+    // All clusters with more than one ROM, biggest first, each starting with the first added
+    // ROM and its members ordered by their similarity to it.
+    std::vector<Cluster> clusters() const;
+
+private:
+    uint32_t find(uint32_t file) const;
+    std::vector<std::string> _files;
+    std::vector<Signature> _signatures;
+    mutable std::vector<uint32_t> _parent;
+};
+
+}
@@ -0,0 +1,184 @@
+//---------------------------------------------------------------------------------------
+// src/scancache.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+
+#include "scancache.hpp"
+
+#include <chiplet/utility.hpp>
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <random>
+
+namespace emu {
+
+void RomAnalysis::merge(const RomAnalysis& other)
+{
+    startAddress = other.startAddress;
+    if(other.analysed) {
+        analysed = true;
+        possibleVariants = other.possibleVariants;
+        usesOddPcAddress = other.usesOddPcAddress;
+        codeBytes = other.codeBytes;
+        stats = other.stats;
+        fullStats = other.fullStats;
+    }
+    if(other.roundTrip != eUNKNOWN) {
+        possibleVariants = other.possibleVariants;
+        usesOddPcAddress = other.usesOddPcAddress;
+        roundTrip = other.roundTrip;
+        sourceLines = other.sourceLines;
+    }
+}
+
+ScanCache::ScanCache(std::string cacheFile, std::string generator)
+    : _cacheFile(std::move(cacheFile))
+    , _generator(std::move(generator))
+{
+}
+
+bool ScanCache::load()
+{
+    std::error_code ec;
+    if(!fs::exists(_cacheFile, ec))
+        return false;
+    try {
+        auto json = nlohmann::json::parse(loadTextFile(_cacheFile));
+        if(json.value("generator", "") != _generator) {
+            // results of a different version might not match, start over
+            return false;
+        }
+        for(const auto& [path, entry] : json.at("files").items()) {
+            _files[path] = {{entry.at("size").get<uint64_t>(), entry.at("mtime").get<int64_t>()}, entry.at("hash").get<uint64_t>(), Sha1::Digest(entry.at("sha1").get<std::string>())};
+        }
+        for(const auto& [digest, entry] : json.at("results").items()) {
+            RomAnalysis analysis;
+            analysis.startAddress = entry.at("start").get<uint16_t>();
+            analysis.possibleVariants = static_cast<Chip8Variant>(entry.at("variants").get<uint64_t>());
+            analysis.usesOddPcAddress = entry.at("oddPc").get<bool>();
+            if(entry.contains("stats") && entry.contains("codeBytes")) {
+                analysis.analysed = true;
+                analysis.codeBytes = entry.at("codeBytes").get<uint32_t>();
+                analysis.stats = entry.at("stats").get<std::map<uint16_t, int>>();
+                analysis.fullStats = entry.at("fullStats").get<std::map<uint16_t, int>>();
+            }
+            if(entry.contains("roundTrip")) {
+                analysis.roundTrip = entry.at("roundTrip").get<bool>() ? RomAnalysis::ePASSED : RomAnalysis::eFAILED;
+                analysis.sourceLines = entry.at("sourceLines").get<int64_t>();
+            }
+            _results[Sha1::Digest(digest)] = std::move(analysis);
+        }
+    }
+    catch(...) {
+        _files.clear();
+        _results.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ScanCache::save()
+{
+    for(auto& update : _updates) {
+        _files[update.path] = update.file;
+        if(!update.analysis.analysed && update.analysis.roundTrip == RomAnalysis::eUNKNOWN)
+            continue;
+        auto& analysis = _results[update.file.digest];
+        if(analysis.startAddress != update.analysis.startAddress)
+            analysis = {};
+        analysis.merge(update.analysis);
+    }
+    _updates.clear();
+    nlohmann::json json;
+    json["generator"] = _generator;
+    auto& files = json["files"] = nlohmann::json::object();
+    for(const auto& [path, entry] : _files) {
+        files[path] = {{"size", entry.key.size}, {"mtime", entry.key.mtime}, {"hash", entry.hash}, {"sha1", entry.digest.to_hex()}};
+    }
+    auto& results = json["results"] = nlohmann::json::object();
+    for(const auto& [digest, analysis] : _results) {
+        auto& entry = results[digest.to_hex()] = {{"start", analysis.startAddress}, {"variants", static_cast<uint64_t>(analysis.possibleVariants)}, {"oddPc", analysis.usesOddPcAddress}};
+        if(analysis.analysed) {
+            entry["codeBytes"] = analysis.codeBytes;
+            entry["stats"] = analysis.stats;
+            entry["fullStats"] = analysis.fullStats;
+        }
+        if(analysis.roundTrip != RomAnalysis::eUNKNOWN) {
+            entry["roundTrip"] = analysis.roundTrip == RomAnalysis::ePASSED;
+            entry["sourceLines"] = analysis.sourceLines;
+        }
+    }
+    auto text = json.dump();
+    // written to a temporary file next to the cache and renamed over it, so an interrupted
+    // run or a concurrent one never leaves a truncated cache behind
+    auto tempFile = fmt::format("{}.{:08x}.tmp", _cacheFile, std::random_device{}());
+    std::error_code ec;
+    if(!writeFile(tempFile, text.data(), text.size())) {
+        fs::remove(tempFile, ec);
+        return false;
+    }
+    fs::rename(tempFile, _cacheFile, ec);
+    if(ec) {
+        fs::remove(tempFile, ec);
+        return false;
+    }
+    return true;
+}
+
+std::optional<ScanCache::FileKey> ScanCache::fileKey(const fs::path& file)
+{
+    std::error_code ec;
+    auto size = fs::file_size(file, ec);
+    if(ec)
+        return {};
+    auto mtime = fs::last_write_time(file, ec);
+    if(ec)
+        return {};
+    return FileKey{size, static_cast<int64_t>(mtime.time_since_epoch().count())};
+}
+
+const ScanCache::FileEntry* ScanCache::lookupFile(const std::string& path, const FileKey& key) const
+{
+    auto iter = _files.find(path);
+    if(iter != _files.end() && iter->second.key == key)
+        return &iter->second;
+    return nullptr;
+}
+
+const RomAnalysis* ScanCache::lookupAnalysis(const Sha1::Digest& digest, uint16_t startAddress) const
+{
+    auto iter = _results.find(digest);
+    if(iter != _results.end() && iter->second.startAddress == startAddress)
+        return &iter->second;
+    return nullptr;
+}
+
+void ScanCache::update(const std::string& path, const FileEntry& file, const RomAnalysis& analysis)
+{
+    _updates.push_back({path, file, analysis});
+}
+
+}
@@ -0,0 +1,102 @@
+//---------------------------------------------------------------------------------------
+// src/scancache.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <chiplet/chip8variants.hpp>
+#include <chiplet/sha1.hpp>
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ghc/fs_fwd.hpp>
+
+namespace fs = ghc::filesystem;
+
+namespace emu {
+
+// The results of analysing a ROM that are needed to report on it in scan, search and
+// round-trip mode without decompiling it again.
+struct RomAnalysis
+{
+    enum RoundTrip { eUNKNOWN, ePASSED, eFAILED };
+    uint16_t startAddress{0x200};
+    bool analysed{false};
+    Chip8Variant possibleVariants{};
+    bool usesOddPcAddress{false};
+    uint32_t codeBytes{0};
+    std::map<uint16_t, int> stats;
+    std::map<uint16_t, int> fullStats;
+    RoundTrip roundTrip{eUNKNOWN};
+    int64_t sourceLines{0};
+    void merge(const RomAnalysis& other);
+};
+
+// A persistent cache that maps (path, size, mtime) to the fast hash and SHA-1 of the
+// content and the SHA-1 to the RomAnalysis of that content. Lookups are safe to be done from multiple
+// threads as long as no update is applied, so updates are collected and only merged
+// into the cache on save().
+class ScanCache
+{
+public:
+    struct FileKey
+    {
+        uint64_t size{};
+        int64_t mtime{};
+        bool operator==(const FileKey& other) const { return size == other.size && mtime == other.mtime; }
+    };
+    struct FileEntry
+    {
+        FileKey key;
+        uint64_t hash{};
+        Sha1::Digest digest;
+    };
+    ScanCache(std::string cacheFile, std::string generator);
+    bool load();
+    bool save();
+    static std::optional<FileKey> fileKey(const fs::path& file);
+    const FileEntry* lookupFile(const std::string& path, const FileKey& key) const;
+    const RomAnalysis* lookupAnalysis(const Sha1::Digest& digest, uint16_t startAddress) const;
+    void update(const std::string& path, const FileEntry& file, const RomAnalysis& analysis);
+
+private:
+    struct Update
+    {
+        std::string path;
+        FileEntry file;
+        RomAnalysis analysis;
+    };
+    std::string _cacheFile;
+    std::string _generator;
+    std::unordered_map<std::string, FileEntry> _files;
+    std::unordered_map<Sha1::Digest, RomAnalysis> _results;
+    std::vector<Update> _updates;
+};
+
+}
@@ -0,0 +1,169 @@
+//---------------------------------------------------------------------------------------
+// src/sourcecache.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#include <chiplet/sourcecache.hpp>
+
+#include <ghc/fs_fwd.hpp>
+
+#include <chiplet/stb_image.h>
+#include <chiplet/trace.hpp>
+#include <chiplet/utility.hpp>
+
+#include <fstream>
+
+namespace fs = ghc::filesystem;
+
+namespace emu {
+
+std::shared_ptr<const std::string> SourceCache::text(const std::string& file)
+{
+    return lookup(_texts, file, [](const std::shared_ptr<const std::string>& data) { return data; });
+}
+
+std::shared_ptr<const SourceCache::Image> SourceCache::image(const std::string& file)
+{
+    return lookup(_images, file, [&file](const std::shared_ptr<const std::string>& data) {
+        CHIPLET_TRACE_SPAN("image decode", file);
+        return decodeImage(*data);
+    });
+}
+
+void SourceCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _texts.clear();
+    _images.clear();
+}
+
+uint64_t SourceCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+}
+
+uint64_t SourceCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+}
+
+template <typename T, typename Decoder>
+std::shared_ptr<const T> SourceCache::lookup(std::unordered_map<std::string, Entry<T>>& entries, const std::string& file, Decoder decode)
+{
+    FileKey key;
+    if(!fileKey(file, key))
+        return decode(loadText(file));
+    auto now = fileClockNow();
+    Entry<T> cached;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto iter = entries.find(file);
+        if(iter != entries.end() && iter->second.key == key) {
+            auto racyUntil = key.mtime + std::chrono::duration_cast<fs::file_time_type::duration>(RACY_WINDOW).count();
+            if(iter->second.checked > racyUntil) {
+                ++_hits;
+                return iter->second.content;
+            }
+            cached = iter->second;
+        }
+    }
+    // loading happens outside the lock, two threads missing the same file both load it
+    auto data = loadText(file);
+    auto digest = calculateSha1(*data);
+    if(cached.content && cached.digest == digest) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_hits;
+        auto iter = entries.find(file);
+        if(iter != entries.end() && iter->second.content == cached.content)
+            iter->second.checked = now;
+        return cached.content;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_misses;
+    }
+    auto content = decode(data);
+    if(content) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        entries[file] = {key, digest, now, content};
+    }
+    return content;
+}
+
+bool SourceCache::fileKey(const std::string& file, FileKey& key)
+{
+    std::error_code ec;
+    auto size = fs::file_size(file, ec);
+    if(ec)
+        return false;
+    auto mtime = fs::last_write_time(file, ec);
+    if(ec)
+        return false;
+    key = {size, static_cast<int64_t>(mtime.time_since_epoch().count())};
+    return true;
+}
+
+int64_t SourceCache::fileClockNow()
+{
+    return static_cast<int64_t>(fs::file_time_type::clock::now().time_since_epoch().count());
+}
+
+std::shared_ptr<const std::string> SourceCache::loadText(const std::string& file)
+{
+    CHIPLET_TRACE_SPAN("file load", file);
+    auto result = std::make_shared<std::string>();
+    std::ifstream is(file, std::ios::binary | std::ios::ate);
+    std::streamsize size = is.tellg();
+    if(size > 0) {
+        is.seekg(0, std::ios::beg);
+        result->resize(size_t(size));
+        if(!is.read(result->data(), size))
+            result->clear();
+    }
+    return result;
+}
+
+std::shared_ptr<const SourceCache::Image> SourceCache::loadImage(const std::string& file)
+{
+    auto data = loadText(file);
+    CHIPLET_TRACE_SPAN("image decode", file);
+    return decodeImage(*data);
+}
+
+std::shared_ptr<const SourceCache::Image> SourceCache::decodeImage(const std::string& data)
+{
+    int width, height, numChannels;
+    auto* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(data.data()), int(data.size()), &width, &height, &numChannels, 1);
+    if(!pixels)
+        return {};
+    auto image = std::make_shared<Image>();
+    image->width = width;
+    image->height = height;
+    image->pixels.assign(pixels, pixels + size_t(width) * size_t(height));
+    stbi_image_free(pixels);
+    return image;
+}
+
+}
@@ -0,0 +1,128 @@
+//---------------------------------------------------------------------------------------
+// src/subroutineindex.cpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+
+#include "subroutineindex.hpp"
+
+#include <chiplet/utility.hpp>
+
+#include <algorithm>
+#include <tuple>
+
+namespace emu {
+
+uint16_t SubroutineIndex::normalizeOpcode(uint16_t opcode, bool shape)
+{
+    switch(opcode >> 12) {
+        case 0x1: case 0x2: case 0xA: case 0xB:
+            return opcode & 0xF000;
+        case 0x3: case 0x4: case 0x6: case 0x7: case 0xC: case 0xD:
+            return shape ? opcode & 0xF000 : opcode;
+        case 0x5: case 0x8: case 0x9:
+            return shape ? opcode & 0xF00F : opcode;
+        case 0xE: case 0xF:
+            return shape ? opcode & 0xF0FF : opcode;
+        default:
+            return opcode;
+    }
+}
+
+SubroutineIndex::Fingerprint SubroutineIndex::fingerprint(uint32_t address, const std::vector<std::pair<uint16_t, int>>& code)
+{
+    constexpr uint64_t BASE = 0x100000001b3ull;
+    uint64_t exact = 0, shape = 0;
+    uint32_t length = 0;
+    auto roll = [&](uint16_t exactWord, uint16_t shapeWord) {
+        exact = exact * BASE + exactWord + 1;
+        shape = shape * BASE + shapeWord + 1;
+        ++length;
+    };
+    for(const auto& [opcode, next] : code) {
+        roll(normalizeOpcode(opcode, false), normalizeOpcode(opcode, true));
+        if(next >= 0) {
+            // the second word of a long I load is an address too
+            roll(0, 0);
+        }
+    }
+    return {mixHash64(exact ^ length), mixHash64(shape ^ length), address, length};
+}
+
+uint32_t SubroutineIndex::addFile(const std::string& name)
+{
+    _files.push_back(name);
+    return uint32_t(_files.size() - 1);
+}
+
+void SubroutineIndex::add(uint32_t file, const Fingerprint& fingerprint)
+{
+    if(fingerprint.length < MIN_LENGTH)
+        return;
+    _partitions[fingerprint.shape >> 56].push_back({fingerprint.shape, fingerprint.exact, file, fingerprint.address, fingerprint.length});
+    ++_numSubroutines;
+}
+
+std::vector<SubroutineIndex::Cluster> SubroutineIndex::clusters(size_t minFiles)
+{
+    std::vector<Cluster> result;
+    for(auto& partition : _partitions) {
+        std::sort(partition.begin(), partition.end(), [](const Record& a, const Record& b) {
+            return std::tie(a.shape, a.exact, a.file, a.address) < std::tie(b.shape, b.exact, b.file, b.address);
+        });
+        for(size_t first = 0; first < partition.size();) {
+            Cluster cluster;
+            cluster.shape = partition[first].shape;
+            cluster.length = partition[first].length;
+            std::vector<uint32_t> files;
+            auto last = first;
+            while(last < partition.size() && partition[last].shape == cluster.shape) {
+                Variant variant;
+                auto exact = partition[last].exact;
+                for(; last < partition.size() && partition[last].shape == cluster.shape && partition[last].exact == exact; ++last) {
+                    const auto& record = partition[last];
+                    if(variant.occurrences.empty() || variant.occurrences.back().file != record.file)
+                        ++variant.numFiles;
+                    variant.occurrences.push_back({record.file, record.address});
+                    files.push_back(record.file);
+                }
+                cluster.variants.push_back(std::move(variant));
+            }
+            std::sort(files.begin(), files.end());
+            cluster.numFiles = size_t(std::unique(files.begin(), files.end()) - files.begin());
+            if(cluster.numFiles >= minFiles) {
+                std::sort(cluster.variants.begin(), cluster.variants.end(), [](const Variant& a, const Variant& b) {
+                    return a.numFiles > b.numFiles || (a.numFiles == b.numFiles && a.occurrences.front().file < b.occurrences.front().file);
+                });
+                result.push_back(std::move(cluster));
+            }
+            first = last;
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const Cluster& a, const Cluster& b) {
+        return std::tie(b.numFiles, b.length, a.shape) < std::tie(a.numFiles, a.length, b.shape);
+    });
+    return result;
+}
+
+}
@@ -0,0 +1,97 @@
+//---------------------------------------------------------------------------------------
+// src/subroutineindex.hpp
+//---------------------------------------------------------------------------------------
+//
+// Copyright (c) 2024, Steffen Schümann <s.schuemann@pobox.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//---------------------------------------------------------------------------------------
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace emu {
+
+// Finds subroutines shared between ROMs. Every called subroutine is fingerprinted with a
+// rolling hash over its opcodes with the 12-bit address operands masked, so relocated
+// copies give the same exact hash, and with a second hash that also masks registers and
+// immediate values, the shape, that groups near-identical copies. The occurrences are
+// stored in a table partitioned by the shape hash, and clusters are found by sorting each
+// partition on its own, so nothing is ever compared pairwise.
+class SubroutineIndex
+{
+public:
+    static constexpr size_t MIN_LENGTH = 5;
+    static constexpr size_t NUM_PARTITIONS = 256;
+    struct Fingerprint
+    {
+        uint64_t exact;
+        uint64_t shape;
+        uint32_t address;
+        uint32_t length;
+    };
+    struct Occurrence
+    {
+        uint32_t file;
+        uint32_t address;
+    };
+    struct Variant
+    {
+        std::vector<Occurrence> occurrences;
+        size_t numFiles{0};
+    };
+    struct Cluster
+    {
+        uint64_t shape{0};
+        uint32_t length{0};
+        size_t numFiles{0};
+        std::vector<Variant> variants{};
+    };
+    // Masks the 12-bit addresses of jumps, calls and I loads, with shape also registers and
+    // immediate values.
+    static uint16_t normalizeOpcode(uint16_t opcode, bool shape);
+    // Gives the fingerprint of a subroutine from its (opcode, long operand or -1) pairs.
+    static Fingerprint fingerprint(uint32_t address, const std::vector<std::pair<uint16_t, int>>& code);
+    uint32_t addFile(const std::string& name);
+    void add(uint32_t file, const Fingerprint& fingerprint);
+    const std::string& fileName(uint32_t file) const { return _files[file]; }
+    size_t numSubroutines() const { return _numSubroutines; }
+    // All groups of same shaped subroutines used in at least minFiles files, most used first.
+    std::vector<Cluster> clusters(size_t minFiles = 2);
+
+private:
+    struct Record
+    {
+        uint64_t shape;
+        uint64_t exact;
+        uint32_t file;
+        uint32_t address;
+        uint32_t length;
+    };
+    std::vector<std::string> _files;
+    std::array<std::vector<Record>, NUM_PARTITIONS> _partitions;
+    size_t _numSubroutines{0};
+};
+
+}
@@ -0,0 +1,87 @@
+//
+// Tests of the Chip8Classifier pre-filter used by the deep analysis scan.
+//
+#include <doctest/doctest.h>
+
+#include <chiplet/chip8classifier.hpp>
+
+#include <string>
+#include <vector>
+
+#include "../src/octo_compiler.hpp"
+
+static std::vector<uint8_t> assemble(const std::string& source)
+{
+    auto program = std::make_unique<octo::Program>(source, 0x200);
+    REQUIRE(program->compile());
+    REQUIRE(!program->isError());
+    return {program->data(), program->data() + program->codeSize()};
+}
+
+TEST_SUITE("Classifier")
+{
+    TEST_CASE("too small")
+    {
+        std::vector<uint8_t> data{0x00, 0xE0};
+        auto result = emu::Chip8Classifier::classify({data.data(), data.size()});
+        CHECK(!result.candidate);
+        CHECK(!result.text);
+        CHECK_EQ(result.validOpcodes, 0);
+    }
+
+    TEST_CASE("too big for the address space")
+    {
+        std::vector<uint8_t> data(0x1000000 - 0x200 + 2, 0x12);
+        CHECK(!emu::Chip8Classifier::classify({data.data(), data.size()}).candidate);
+    }
+
+    TEST_CASE("text")
+    {
+        std::string text = "# This is a readme, not a program.\nIt has a few lines of text,\r\n\tsome of them indented.\n";
+        auto result = emu::Chip8Classifier::classify({reinterpret_cast<const uint8_t*>(text.data()), text.size()});
+        CHECK(result.text);
+        CHECK(!result.candidate);
+    }
+
+    TEST_CASE("zero filled")
+    {
+        std::vector<uint8_t> data(512, 0);
+        auto result = emu::Chip8Classifier::classify({data.data(), data.size()});
+        CHECK(!result.text);
+        CHECK(!result.candidate);
+        CHECK_EQ(result.validOpcodes, 0);
+        CHECK_EQ(result.invalidOpcodes, 1);
+    }
+
+    TEST_CASE("known CHIP-8 program")
+    {
+        auto rom = assemble(R"(
+: ball 0x18 0x3C 0x7E 0xFF
+: draw
+	i := ball
+	sprite v0 v1 4
+	return
+: main
+	clear
+	v0 := 10
+	v1 := 12
+	v2 := 0
+	draw
+	loop
+		v2 += 1
+		if v2 == 60 then v2 := 0
+		vf := 1
+		v0 += vf
+		draw
+		delay := v2
+	again
+)");
+        auto result = emu::Chip8Classifier::classify({rom.data(), rom.size()});
+        CHECK(!result.text);
+        CHECK(result.candidate);
+        CHECK_EQ(result.invalidOpcodes, 0);
+        CHECK(result.validOpcodes >= 11);
+        CHECK(result.branches > 0);
+        CHECK_EQ(result.plausibleBranches, result.branches);
+    }
+}
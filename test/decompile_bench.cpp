@@ -0,0 +1,84 @@
+//
+// Measures Chip8Decompiler::decompile on the ROMs of a directory and on a synthetic
+// ROM of nested subroutines, each calling the one below it, which makes the code
+// discovery run into every entry point only after all the ones above it.
+//
+// usage: decompile-bench <directory> [rounds] [depth]
+//
+#include <chiplet/chip8decompiler.hpp>
+#include <chiplet/utility.hpp>
+#include <ghc/fs_impl.hpp>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <sstream>
+
+struct Rom
+{
+    std::string name;
+    std::vector<uint8_t> data;
+};
+
+static std::vector<uint8_t> callChain(int depth)
+{
+    // 0x200: call the topmost subroutine and loop, then a gap of zeros, then
+    // subroutine n at 0xA00 + 4n: call n-1, return
+    std::vector<uint8_t> rom;
+    auto emit = [&rom](uint16_t opcode) {
+        rom.push_back(opcode >> 8);
+        rom.push_back(opcode & 0xff);
+    };
+    emit(0x2000 | (0xA00 + 4 * (depth - 1)));
+    emit(0x1202);
+    rom.resize(0x800);
+    emit(0x00EE);
+    emit(0x00EE);
+    for(int i = 1; i < depth; ++i) {
+        emit(0x2000 | (0xA00 + 4 * (i - 1)));
+        emit(0x00EE);
+    }
+    return rom;
+}
+
+static void bench(const std::string& name, const std::vector<Rom>& roms, int rounds)
+{
+    uint64_t check = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        for(const auto& rom : roms) {
+            emu::Chip8Decompiler dec;
+            std::ostringstream os;
+            dec.decompile(rom.name, rom.data.data(), 0x200, uint32_t(rom.data.size()), 0x200, &os, false, true);
+            check += std::hash<std::string>()(os.str());
+        }
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << fmt::format("{:<20} {:>10.3f} ms/round  ({} ROMs, check {:016x})", name, seconds * 1000 / rounds, roms.size(), check) << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2) {
+        std::cerr << "USAGE: decompile-bench <directory> [rounds] [depth]" << std::endl;
+        return 1;
+    }
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+    int depth = argc > 3 ? std::atoi(argv[3]) : 10000;
+    if(rounds < 1 || depth < 1 || depth > (0x10000 - 0xA00) / 4) {
+        std::cerr << "ERROR: invalid rounds or depth" << std::endl;
+        return 1;
+    }
+    std::vector<Rom> roms;
+    for(const auto& de : fs::recursive_directory_iterator(argv[1], fs::directory_options::skip_permission_denied)) {
+        if(de.is_regular_file() && de.path().extension() == ".ch8") {
+            auto data = loadFile(de.path());
+            if(!data.empty() && data.size() <= 0x10000 - 0x200)
+                roms.push_back({de.path().filename().string(), std::move(data)});
+        }
+    }
+    std::cout << "Benchmarking " << roms.size() << " ROMs and a call chain of depth " << depth << ", " << rounds << " rounds" << std::endl;
+    bench("directory", roms, rounds);
+    bench("call chain", {{"chain.ch8", callChain(depth)}}, rounds);
+    return 0;
+}
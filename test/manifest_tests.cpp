@@ -0,0 +1,204 @@
+//
+// Tests of the corpus manifest written by --manifest and the queries of --query.
+//
+#include <doctest/doctest.h>
+
+#include <chiplet/utility.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../src/manifest.hpp"
+#include "../src/manifestquery.hpp"
+#include "testutil.hpp"
+
+namespace {
+
+const Sha1::Digest pongDigest("0123456789abcdef0123456789abcdef01234567");
+const Sha1::Digest xoDigest("fedcba9876543210fedcba9876543210fedcba98");
+const Sha1::Digest schipDigest("00112233445566778899aabbccddeeff00112233");
+
+void writeTestManifest(const std::string& file)
+{
+    emu::ManifestWriter writer;
+    writer.addFile("games/pong.ch8", pongDigest, 246, 0x200, emu::C8V::CHIP_8, false, 200, {{0x00E0, 1}, {0x6A02, 3}, {0xF029, 2}});
+    writer.addFile("xo/demo.xo8", xoDigest, 4000, 0x200, emu::C8V::XO_CHIP, true, 3000, {{0x00E0, 1}, {0xF002, 1}, {0xF129, 4}});
+    writer.addFile("schip/big.ch8", schipDigest, 3600, 0x200, emu::C8V::SCHIP_1_1, false, 1000, {{0x00FF, 1}});
+    writer.addDuplicate();
+    writer.addDuplicate();
+    REQUIRE(writer.write(file));
+}
+
+std::vector<uint32_t> select(const emu::Manifest& manifest, const std::string& query)
+{
+    emu::ManifestQuery mq;
+    REQUIRE(mq.parse(query));
+    return mq.select(manifest);
+}
+
+std::string parseError(const std::string& query)
+{
+    emu::ManifestQuery mq;
+    CHECK(!mq.parse(query));
+    return mq.error();
+}
+
+}
+
+TEST_SUITE("Manifest")
+{
+    TEST_CASE("write and open round trip")
+    {
+        TempFile file("manifest-roundtrip.c8m");
+        writeTestManifest(file.path);
+
+        emu::Manifest manifest;
+        REQUIRE(manifest.open(file.path));
+        REQUIRE_EQ(manifest.numRows(), 3);
+        CHECK_EQ(manifest.numDuplicates(), 2);
+        CHECK(manifest.fileName(0) == "games/pong.ch8");
+        CHECK(manifest.fileName(1) == "xo/demo.xo8");
+        CHECK(manifest.fileName(2) == "schip/big.ch8");
+        CHECK(manifest.digest(0) == pongDigest);
+        CHECK(manifest.digest(1) == xoDigest);
+        CHECK(manifest.digest(2) == schipDigest);
+        CHECK_EQ(manifest.sizes()[1], 4000);
+        CHECK_EQ(manifest.startAddresses()[0], 0x200);
+        CHECK_EQ(manifest.variants()[1], static_cast<uint64_t>(emu::C8V::XO_CHIP));
+        CHECK_EQ(manifest.oddPc()[0], 0);
+        CHECK_EQ(manifest.oddPc()[1], 1);
+        CHECK_EQ(manifest.codeBytes()[2], 1000);
+
+        auto opcodes = manifest.opcodes(0);
+        auto counts = manifest.counts(0);
+        REQUIRE_EQ(opcodes.size(), 3);
+        REQUIRE_EQ(counts.size(), 3);
+        CHECK_EQ(opcodes[0], 0x00E0);
+        CHECK_EQ(opcodes[1], 0x6A02);
+        CHECK_EQ(opcodes[2], 0xF029);
+        CHECK_EQ(counts[1], 3);
+        CHECK_EQ(manifest.opcodes(2).size(), 1);
+        CHECK_EQ(manifest.counts(2)[0], 1);
+    }
+
+    TEST_CASE("corrupt files are rejected")
+    {
+        TempFile file("manifest-corrupt.c8m");
+        writeTestManifest(file.path);
+        auto valid = readAll(file.path);
+        emu::Manifest manifest;
+
+        auto badMagic = valid;
+        badMagic[0] = 'X';
+        writeAll(file.path, badMagic);
+        CHECK(!manifest.open(file.path));
+        CHECK_EQ(manifest.numRows(), 0);
+
+        auto misaligned = valid;
+        uint64_t offset;
+        auto columnOffset = offsetof(emu::manifest::Header, columns) + emu::manifest::eNAMES * sizeof(uint64_t);
+        std::memcpy(&offset, &misaligned[columnOffset], sizeof(offset));
+        ++offset;
+        std::memcpy(&misaligned[columnOffset], &offset, sizeof(offset));
+        writeAll(file.path, misaligned);
+        CHECK(!manifest.open(file.path));
+
+        auto tooManyRows = valid;
+        uint32_t rows = 1000;
+        std::memcpy(&tooManyRows[offsetof(emu::manifest::Header, numRows)], &rows, sizeof(rows));
+        writeAll(file.path, tooManyRows);
+        CHECK(!manifest.open(file.path));
+
+        // entry counts whose column sizes overflow to small values
+        auto tooManyEntries = valid;
+        uint64_t entries = (uint64_t(1) << 63) + 3;
+        std::memcpy(&tooManyEntries[offsetof(emu::manifest::Header, numEntries)], &entries, sizeof(entries));
+        writeAll(file.path, tooManyEntries);
+        CHECK(!manifest.open(file.path));
+
+        auto hugeNames = valid;
+        uint64_t namesSize = ~uint64_t(0);
+        std::memcpy(&hugeNames[offsetof(emu::manifest::Header, namesSize)], &namesSize, sizeof(namesSize));
+        writeAll(file.path, hugeNames);
+        CHECK(!manifest.open(file.path));
+
+        writeAll(file.path, valid.substr(0, valid.size() - 16));
+        CHECK(!manifest.open(file.path));
+
+        writeAll(file.path, valid.substr(0, 8));
+        CHECK(!manifest.open(file.path));
+
+        CHECK(!manifest.open(file.path + ".missing"));
+    }
+}
+
+TEST_SUITE("ManifestQuery")
+{
+    TEST_CASE("columns and comparisons")
+    {
+        TempFile file("manifest-query.c8m");
+        writeTestManifest(file.path);
+        emu::Manifest manifest;
+        REQUIRE(manifest.open(file.path));
+
+        CHECK((select(manifest, "size > 3584") == std::vector<uint32_t>{1, 2}));
+        CHECK((select(manifest, "size <= 0xF6") == std::vector<uint32_t>{0}));
+        CHECK((select(manifest, "start == 0x200") == std::vector<uint32_t>{0, 1, 2}));
+        CHECK((select(manifest, "oddpc") == std::vector<uint32_t>{1}));
+        CHECK((select(manifest, "!oddpc") == std::vector<uint32_t>{0, 2}));
+        CHECK((select(manifest, "data == 46") == std::vector<uint32_t>{0}));
+        CHECK((select(manifest, "code >= 1000") == std::vector<uint32_t>{1, 2}));
+        CHECK((select(manifest, "opcodes == 3") == std::vector<uint32_t>{0, 1}));
+        CHECK((select(manifest, "variants & xo_chip") == std::vector<uint32_t>{1}));
+        CHECK(select(manifest, "size > 100000").empty());
+    }
+
+    TEST_CASE("operator precedence")
+    {
+        TempFile file("manifest-precedence.c8m");
+        writeTestManifest(file.path);
+        emu::Manifest manifest;
+        REQUIRE(manifest.open(file.path));
+
+        // & binds tighter than the comparison, the comparison tighter than &&
+        CHECK((select(manifest, "variants & XO_CHIP && size > 3584") == std::vector<uint32_t>{1}));
+        CHECK((select(manifest, "variants & (XO_CHIP | SCHIP_1_1) != 0") == std::vector<uint32_t>{1, 2}));
+        // & binds tighter than |
+        CHECK((select(manifest, "variants & XO_CHIP | SCHIP_1_1 != 0") == std::vector<uint32_t>{0, 1, 2}));
+        // && binds tighter than ||
+        CHECK((select(manifest, "size < 300 || size > 3584 && variants & SCHIP_1_1") == std::vector<uint32_t>{0, 2}));
+        CHECK((select(manifest, "(size < 300 || size > 3584) && variants & SCHIP_1_1") == std::vector<uint32_t>{2}));
+        CHECK((select(manifest, "!(oddpc || size < 300)") == std::vector<uint32_t>{2}));
+    }
+
+    TEST_CASE("opcode patterns")
+    {
+        TempFile file("manifest-uses.c8m");
+        writeTestManifest(file.path);
+        emu::Manifest manifest;
+        REQUIRE(manifest.open(file.path));
+
+        CHECK((select(manifest, "uses(F029)") == std::vector<uint32_t>{0}));
+        CHECK((select(manifest, "uses(F?29)") == std::vector<uint32_t>{0, 1}));
+        CHECK((select(manifest, "uses(Fx29)") == std::vector<uint32_t>{0, 1}));
+        CHECK((select(manifest, "uses(FX29) >= 4") == std::vector<uint32_t>{1}));
+        CHECK((select(manifest, "uses(00E0) && !uses(6xxx)") == std::vector<uint32_t>{1}));
+        CHECK((select(manifest, "uses(00F)") == std::vector<uint32_t>{2}));
+    }
+
+    TEST_CASE("parse errors")
+    {
+        CHECK(parseError("size >") == "unexpected end of query at position 7");
+        CHECK(parseError("(size > 1") == "missing ')' at position 10");
+        CHECK(parseError("") == "unexpected end of query at position 1");
+        CHECK(parseError("size > 1 )") == "unexpected ')' at position 10");
+        CHECK(parseError("size > 1 && foo") == "unknown name 'foo' at position 13");
+        CHECK(parseError("uses F029") == "expected '(' after uses at position 6");
+        CHECK(parseError("uses(G029)") == "expected an opcode pattern like F?29 at position 6");
+        CHECK(parseError("uses(F0290)") == "expected an opcode pattern like F?29 at position 11");
+        CHECK(parseError("uses(F029") == "missing ')' at position 10");
+        CHECK(parseError("size > 99999999999999999999") == "invalid number at position 8");
+    }
+}
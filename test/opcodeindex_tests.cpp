@@ -0,0 +1,119 @@
+//
+// Tests of the opcode index file written by --index and read by --use-index.
+//
+#include <doctest/doctest.h>
+
+#include <chiplet/utility.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "../src/opcodeindex.hpp"
+#include "testutil.hpp"
+
+TEST_SUITE("OpcodeIndex")
+{
+    TEST_CASE("write and open round trip")
+    {
+        TempFile file("index-roundtrip.idx");
+        emu::OpcodeIndexWriter writer;
+        writer.addFile("games/pong.ch8", 246, emu::C8V::CHIP_8 | emu::C8V::SCHIP_1_1, {{0x00E0, 1}, {0x6A02, 3}, {0xD015, 7}});
+        writer.addFile("demos/x.ch8", 1024, emu::C8V::XO_CHIP, {{0x00E0, 2}, {0xF002, 1}});
+        writer.addDuplicate();
+        REQUIRE(writer.write(file.path));
+
+        emu::OpcodeIndex index;
+        REQUIRE(index.open(file.path));
+        CHECK_EQ(index.numFiles(), 2);
+        CHECK_EQ(index.numDuplicates(), 1);
+        CHECK(index.fileName(0) == "games/pong.ch8");
+        CHECK(index.fileName(1) == "demos/x.ch8");
+        CHECK_EQ(index.fileSize(0), 246);
+        CHECK_EQ(index.fileSize(1), 1024);
+        CHECK(index.variants(0) == (emu::C8V::CHIP_8 | emu::C8V::SCHIP_1_1));
+        CHECK(index.variants(1) == emu::C8V::XO_CHIP);
+
+        auto cls = index.postings(0x00E0);
+        REQUIRE_EQ(cls.size(), 2);
+        CHECK_EQ(cls[0].file, 0);
+        CHECK_EQ(cls[0].count, 1);
+        CHECK_EQ(cls[1].file, 1);
+        CHECK_EQ(cls[1].count, 2);
+        auto draw = index.postings(0xD015);
+        REQUIRE_EQ(draw.size(), 1);
+        CHECK_EQ(draw[0].file, 0);
+        CHECK_EQ(draw[0].count, 7);
+        auto audio = index.postings(0xF002);
+        REQUIRE_EQ(audio.size(), 1);
+        CHECK_EQ(audio[0].file, 1);
+        CHECK(index.postings(0x1234).empty());
+        CHECK(index.postings(0xFFFF).empty());
+    }
+
+    TEST_CASE("empty index")
+    {
+        TempFile file("index-empty.idx");
+        emu::OpcodeIndexWriter writer;
+        REQUIRE(writer.write(file.path));
+        emu::OpcodeIndex index;
+        REQUIRE(index.open(file.path));
+        CHECK_EQ(index.numFiles(), 0);
+        CHECK(index.postings(0x00E0).empty());
+    }
+
+    TEST_CASE("corrupt files are rejected")
+    {
+        TempFile file("index-corrupt.idx");
+        emu::OpcodeIndexWriter writer;
+        writer.addFile("a.ch8", 100, emu::C8V::CHIP_8, {{0x00E0, 1}});
+        REQUIRE(writer.write(file.path));
+        auto valid = readAll(file.path);
+        emu::OpcodeIndex index;
+
+        auto badMagic = valid;
+        badMagic[7] = '9';
+        writeAll(file.path, badMagic);
+        CHECK(!index.open(file.path));
+        CHECK_EQ(index.numFiles(), 0);
+
+        emu::opcodeindex::Header header;
+        std::memcpy(&header, valid.data(), sizeof(header));
+        auto corrupted = [&](size_t position, auto value) {
+            auto data = valid;
+            std::memcpy(&data[position], &value, sizeof(value));
+            writeAll(file.path, data);
+            return !index.open(file.path);
+        };
+
+        // offsets past the end, including ones where offset + length wraps around
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, postingsOffset), ~uint64_t(0) >> 8));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, postingsOffset), ~uint64_t(7)));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, filesOffset), ~uint64_t(7)));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, directoryOffset), ~uint64_t(7)));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, namesOffset), ~uint64_t(7)));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, directoryOffset), header.directoryOffset + 4));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, numFiles), uint32_t(0x10000000)));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, numPostings), ~uint64_t(0)));
+        // postings referring to a file that doesn't exist
+        CHECK(corrupted(header.postingsOffset + offsetof(emu::opcodeindex::Posting, file), uint32_t(1)));
+        CHECK(corrupted(offsetof(emu::opcodeindex::Header, numFiles), uint32_t(0)));
+        // a directory that isn't monotonic
+        CHECK(corrupted(header.directoryOffset + 0x100 * sizeof(uint32_t), uint32_t(0)));
+        CHECK(corrupted(header.directoryOffset, uint32_t(1)));
+        // a name running into the directory
+        CHECK(corrupted(header.filesOffset + offsetof(emu::opcodeindex::FileRecord, nameLength), uint32_t(0x1000)));
+
+        writeAll(file.path, valid.substr(0, valid.size() / 2));
+        CHECK(!index.open(file.path));
+
+        writeAll(file.path, valid.substr(0, sizeof(emu::opcodeindex::Header) - 1));
+        CHECK(!index.open(file.path));
+
+        CHECK(!index.open(file.path + ".missing"));
+
+        writeAll(file.path, valid);
+        CHECK(index.open(file.path));
+        CHECK_EQ(index.numFiles(), 1);
+    }
+}
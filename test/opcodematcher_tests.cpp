@@ -0,0 +1,102 @@
+//
+// Tests of the table driven opcode pattern matcher used by -f/--find.
+//
+#include <doctest/doctest.h>
+
+#include <chiplet/opcodematcher.hpp>
+#include <chiplet/utility.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace emu;
+
+namespace {
+
+uint32_t addPattern(OpcodeMatcher& matcher, const std::string& pattern)
+{
+    return matcher.add(opcodeFromPattern(pattern), maskFromPattern(pattern));
+}
+
+}
+
+TEST_SUITE("OpcodeMatcher")
+{
+    TEST_CASE("empty matcher")
+    {
+        OpcodeMatcher matcher;
+        CHECK(matcher.empty());
+        CHECK_EQ(matcher.numSets(), 1);
+        CHECK(!matcher.matches(0x0000));
+        CHECK(matcher.patterns(0xF029).empty());
+    }
+
+    TEST_CASE("exact pattern")
+    {
+        OpcodeMatcher matcher;
+        CHECK_EQ(addPattern(matcher, "00E0"), 0);
+        CHECK(matcher.matches(0x00E0));
+        CHECK(!matcher.matches(0x00EE));
+        CHECK(!matcher.matches(0x10E0));
+        CHECK_EQ(matcher.size(), 1);
+    }
+
+    TEST_CASE("x and ? wildcards")
+    {
+        OpcodeMatcher matcher;
+        auto fx29 = addPattern(matcher, "Fx29");
+        auto dxyn = addPattern(matcher, "D???");
+        auto xy0 = addPattern(matcher, "8xy0");
+        CHECK(matcher.matches(0xF029));
+        CHECK(matcher.matches(0xFA29));
+        CHECK(!matcher.matches(0xFA2A));
+        CHECK(!matcher.matches(0xEA29));
+        CHECK(matcher.matches(0xD000));
+        CHECK(matcher.matches(0xDFFF));
+        CHECK(matcher.matches(0x8120));
+        CHECK(!matcher.matches(0x8121));
+        CHECK((matcher.patterns(0xFE29) == OpcodeMatcher::PatternList{fx29}));
+        CHECK((matcher.patterns(0xD123) == OpcodeMatcher::PatternList{dxyn}));
+        CHECK((matcher.patterns(0x8AB0) == OpcodeMatcher::PatternList{xy0}));
+        // both spellings of a wildcard compile to the same value and mask
+        CHECK_EQ(opcodeFromPattern("Fx29"), opcodeFromPattern("F?29"));
+        CHECK_EQ(maskFromPattern("Fx29"), maskFromPattern("F?29"));
+        CHECK_EQ(maskFromPattern("Fx29"), 0xF0FF);
+    }
+
+    TEST_CASE("overlapping patterns")
+    {
+        OpcodeMatcher matcher;
+        auto any = addPattern(matcher, "F???");
+        auto font = addPattern(matcher, "F?29");
+        auto exact = addPattern(matcher, "F129");
+        CHECK((matcher.patterns(0xF000) == OpcodeMatcher::PatternList{any}));
+        CHECK((matcher.patterns(0xF229) == OpcodeMatcher::PatternList{any, font}));
+        CHECK((matcher.patterns(0xF129) == OpcodeMatcher::PatternList{any, font, exact}));
+        CHECK(matcher.patterns(0xE129).empty());
+        CHECK(matcher.setId(0xF229) == matcher.setId(0xF329));
+        CHECK(matcher.setId(0xF229) != matcher.setId(0xF129));
+        CHECK(matcher.setId(0xF229) != matcher.setId(0xF22A));
+        CHECK_EQ(matcher.setId(0x1234), 0);
+        CHECK((matcher.patternsOfSet(matcher.setId(0xF129)) == OpcodeMatcher::PatternList{any, font, exact}));
+    }
+
+    TEST_CASE("table agrees with a linear scan")
+    {
+        const std::vector<std::string> patterns = {"????", "0x?E", "00E0", "8xy?", "8??6", "Fx29", "F?2?", "D0x5"};
+        OpcodeMatcher matcher;
+        for(const auto& pattern : patterns)
+            addPattern(matcher, pattern);
+        int mismatches = 0;
+        for(uint32_t opcode = 0; opcode <= 0xFFFF; ++opcode) {
+            OpcodeMatcher::PatternList expected;
+            for(uint32_t i = 0; i < patterns.size(); ++i) {
+                if((opcode & maskFromPattern(patterns[i])) == opcodeFromPattern(patterns[i]))
+                    expected.push_back(i);
+            }
+            if(matcher.patterns(uint16_t(opcode)) != expected)
+                ++mismatches;
+        }
+        CHECK_EQ(mismatches, 0);
+    }
+}
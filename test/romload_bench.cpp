@@ -0,0 +1,64 @@
+//
+// Compares the throughput of the classic loadFile() path with the MappedFile view
+// on a directory of ROMs, both including a SHA-1 over the content like checkDouble.
+//
+// usage: romload-bench <directory> [rounds]
+//
+#include <chiplet/utility.hpp>
+#include <chiplet/mappedfile.hpp>
+#include <ghc/fs_impl.hpp>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+static uint64_t consume(const uint8_t* data, size_t size)
+{
+    auto digest = calculateSha1(data, size);
+    return std::hash<Sha1::Digest>()(digest);
+}
+
+static void bench(const std::string& name, const std::vector<fs::path>& files, int rounds, const std::function<uint64_t(const fs::path&)>& load)
+{
+    uint64_t check = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        for(const auto& file : files) {
+            check += load(file);
+        }
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << fmt::format("{:<20} {:>12.0f} files/s  ({:.3f}s, check {:016x})", name, double(files.size()) * rounds / seconds, seconds, check) << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2) {
+        std::cerr << "USAGE: romload-bench <directory> [rounds]" << std::endl;
+        return 1;
+    }
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+    std::vector<fs::path> files;
+    for(const auto& de : fs::recursive_directory_iterator(argv[1], fs::directory_options::skip_permission_denied)) {
+        if(de.is_regular_file())
+            files.push_back(de.path());
+    }
+    std::cout << "Benchmarking " << files.size() << " files, " << rounds << " rounds" << std::endl;
+    bench("loadFile", files, rounds, [](const fs::path& file) {
+        auto data = loadFile(file);
+        return consume(data.data(), data.size());
+    });
+    bench("MappedFile (pread)", files, rounds, [](const fs::path& file) {
+        emu::MappedFile data(file, 16 * 1024 * 1024, emu::MappedFile::eREAD);
+        return consume(data.data(), data.size());
+    });
+    bench("MappedFile (mmap)", files, rounds, [](const fs::path& file) {
+        emu::MappedFile data(file, 16 * 1024 * 1024, emu::MappedFile::eMAP);
+        return consume(data.data(), data.size());
+    });
+    bench("MappedFile (auto)", files, rounds, [](const fs::path& file) {
+        emu::MappedFile data(file);
+        return consume(data.data(), data.size());
+    });
+    return 0;
+}
@@ -0,0 +1,40 @@
+//
+// Helpers shared by the tests that write and read back files.
+//
+#pragma once
+
+#include <chiplet/utility.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+// A file in the temp directory that is removed again when the test ends.
+struct TempFile
+{
+    explicit TempFile(const std::string& name)
+        : path((fs::temp_directory_path() / ("chiplet-test-" + name)).string())
+    {
+    }
+    ~TempFile()
+    {
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+    std::string path;
+};
+
+inline std::string readAll(const std::string& file)
+{
+    std::ifstream is(file, std::ios::binary);
+    return {std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+}
+
+inline void writeAll(const std::string& file, const std::string& data)
+{
+    std::ofstream os(file, std::ios::binary | std::ios::trunc);
+    os.write(data.data(), std::streamsize(data.size()));
+}